@@ -19,8 +19,12 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,10 +37,126 @@
 #    endif
 #endif
 
+#ifdef _WIN32
+#    include <windows.h>
+#elif defined(HAVE_MMAP)
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && defined(HAVE_PTHREAD) && defined(HAVE_STDATOMIC_H)
+#    include <pthread.h>
+#    include <stdatomic.h>
+#endif
+
 #include "optlib.h"
 #include "optlib_internal.h"
 
-static char *translate_w32_option(char const *long_opt) {
+#ifdef _WIN32
+#    define environ _environ
+#else
+extern char **environ;
+#endif
+
+#define SEEN_WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+enum {
+    STAGE_ARGV,
+    STAGE_OVERLAY,
+    STAGE_CONSTRAINTS,
+};
+
+static void *default_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *default_resize(void *ctx, void *ptr, size_t old_size,
+                            size_t new_size) {
+    (void)ctx;
+    (void)old_size;
+    return realloc(ptr, new_size);
+}
+
+static void default_release(void *ctx, void *ptr, size_t size) {
+    (void)ctx;
+    (void)size;
+    free(ptr);
+}
+
+static optlib_allocator const default_allocator = {
+    &default_alloc, &default_resize, &default_release, NULL};
+
+/* Each block is preceded by its size so that accounting and the size
+   arguments of the hooks work for every free. */
+typedef union alloc_header {
+    size_t size;
+    long double align_ld;
+    long long align_ll;
+    void *align_ptr;
+} alloc_header;
+
+static void *tracked_alloc(optlib_allocator const *a,
+                           optlib_alloc_stats *stats, size_t size) {
+    alloc_header *h = a->alloc(a->ctx, sizeof(alloc_header) + size);
+    if (!h) return NULL;
+    h->size = size;
+    ++stats->allocations;
+    ++stats->live_allocations;
+    stats->current_bytes += size;
+    if (stats->peak_bytes < stats->current_bytes) {
+        stats->peak_bytes = stats->current_bytes;
+    }
+    return h + 1;
+}
+
+static void tracked_free(optlib_allocator const *a, optlib_alloc_stats *stats,
+                         void *ptr) {
+    if (!ptr) return;
+    alloc_header *h = (alloc_header *)ptr - 1;
+    --stats->live_allocations;
+    stats->current_bytes -= h->size;
+    a->release(a->ctx, h, sizeof(alloc_header) + h->size);
+}
+
+static void *opt_alloc(optlib_parser *p, size_t size) {
+    return tracked_alloc(&p->allocator, &p->alloc_stats, size);
+}
+
+static void *opt_realloc(optlib_parser *p, void *ptr, size_t size) {
+    if (!ptr) return opt_alloc(p, size);
+
+    alloc_header *h = (alloc_header *)ptr - 1;
+    size_t old_size = h->size;
+    h = p->allocator.resize(p->allocator.ctx, h,
+                            sizeof(alloc_header) + old_size,
+                            sizeof(alloc_header) + size);
+    if (!h) return NULL;
+    h->size = size;
+    ++p->alloc_stats.allocations;
+    p->alloc_stats.current_bytes += size;
+    p->alloc_stats.current_bytes -= old_size;
+    if (p->alloc_stats.peak_bytes < p->alloc_stats.current_bytes) {
+        p->alloc_stats.peak_bytes = p->alloc_stats.current_bytes;
+    }
+    return h + 1;
+}
+
+static void opt_free(optlib_parser *p, void *ptr) {
+    tracked_free(&p->allocator, &p->alloc_stats, ptr);
+}
+
+static char *opt_strdup(optlib_parser *p, char const *str) {
+    size_t len = strlen(str) + 1;
+    char *result = opt_alloc(p, len);
+    if (!result) return NULL;
+    memcpy(result, str, len);
+    return result;
+}
+
+static char *translate_w32_option(optlib_parser *p, char const *long_opt) {
     size_t len = strlen(long_opt);
     size_t n_hyphen = 0;
     for (size_t i = 0; i < len; ++i) {
@@ -44,7 +164,7 @@ static char *translate_w32_option(char const *long_opt) {
             ++n_hyphen;
         }
     }
-    char *result = malloc(len - n_hyphen + 1);
+    char *result = opt_alloc(p, len - n_hyphen + 1);
     if (!result) return NULL;
     size_t off = 0;
     bool prev_hyphen = true;
@@ -64,12 +184,131 @@ static char *translate_w32_option(char const *long_opt) {
     return result;
 }
 
-optlib_parser *optlib_parser_new(int argc, char **argv) {
+/* Maps the file privately, so that writes made by optlib (e.g. NUL
+   terminators) never reach the file itself.  Without writable, pages are
+   mapped read-only and shared with other processes mapping the file. */
+static bool map_file(optlib_parser *p, char const *path, bool writable,
+                     char **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+#if defined(_WIN32) || defined(HAVE_MMAP)
+    (void)p;
+#else
+    (void)writable;
+#endif
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return false;
+    }
+    if (!file_size.QuadPart) {
+        CloseHandle(file);
+        return true;
+    }
+    HANDLE mapping = CreateFileMappingA(
+        file, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) return false;
+    /* the view keeps the mapping object alive */
+    *data = MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ,
+                          0, 0, 0);
+    CloseHandle(mapping);
+    if (!*data) return false;
+    *size = (size_t)file_size.QuadPart;
+    return true;
+#elif defined(HAVE_MMAP)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+    if (!st.st_size) {
+        close(fd);
+        return true;
+    }
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *mapped = mmap(NULL, (size_t)st.st_size, prot, MAP_PRIVATE, fd, 0);
+    int saved_errno = errno;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        errno = saved_errno;
+        return false;
+    }
+    *data = mapped;
+    *size = (size_t)st.st_size;
+    return true;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    size_t cap = 0;
+    for (;;) {
+        if (*size == cap) {
+            cap = cap ? cap << 1 : 4096;
+            char *new_data = opt_realloc(p, *data, cap);
+            if (!new_data) {
+                opt_free(p, *data);
+                fclose(f);
+                *data = NULL;
+                return false;
+            }
+            *data = new_data;
+        }
+        size_t n = fread(*data + *size, 1, cap - *size, f);
+        if (!n) break;
+        *size += n;
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) {
+        opt_free(p, *data);
+        *data = NULL;
+    }
+    return ok;
+#endif
+}
+
+static void unmap_file(optlib_parser *p, char *data, size_t size) {
+    if (!data) return;
+#ifdef _WIN32
+    (void)p;
+    (void)size;
+    UnmapViewOfFile(data);
+#elif defined(HAVE_MMAP)
+    (void)p;
+    munmap(data, size);
+#else
+    (void)size;
+    opt_free(p, data);
+#endif
+}
+
+static void config_free(optlib_parser *p, optlib_config *conf) {
+    unmap_file(p, conf->data, conf->size);
+    opt_free(p, conf->path);
+    opt_free(p, conf->entries);
+    opt_free(p, conf->index);
+    opt_free(p, conf->tail_value);
+    memset(conf, 0, sizeof(optlib_config));
+}
+
+optlib_parser *optlib_parser_new_with_allocator(int argc, char **argv,
+                                                optlib_allocator const *a) {
     if (argc <= 0) return NULL;
+    if (!a) a = &default_allocator;
 
-    optlib_parser *p = malloc(sizeof(optlib_parser));
+    optlib_alloc_stats stats;
+    memset(&stats, 0, sizeof(optlib_alloc_stats));
+    optlib_parser *p = tracked_alloc(a, &stats, sizeof(optlib_parser));
     if (!p) return NULL;
     memset(p, 0, sizeof(optlib_parser));
+    p->allocator = *a;
+    p->alloc_stats = stats;
 
     /* duplicate argc and argv */
     p->argc = argc;
@@ -78,8 +317,11 @@ optlib_parser *optlib_parser_new(int argc, char **argv) {
 #endif
     p->argv = argv;
 
-    p->options = malloc(sizeof(optlib_options));
-    if (!p->options) return NULL;
+    p->options = opt_alloc(p, sizeof(optlib_options));
+    if (!p->options) {
+        opt_free(p, p);
+        return NULL;
+    }
     memset(p->options, 0, sizeof(optlib_options));
 
 #if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
@@ -90,26 +332,46 @@ optlib_parser *optlib_parser_new(int argc, char **argv) {
     return p;
 }
 
+optlib_parser *optlib_parser_new(int argc, char **argv) {
+    return optlib_parser_new_with_allocator(argc, argv, &default_allocator);
+}
+
 void optlib_parser_free(optlib_parser *p) {
-    for (size_t i = 0; i < p->options->option_count; ++i) {
-        free(p->options->options[i].long_opt);
-        free(p->options->options[i].description);
+    if (!p) return;
+
+    for (size_t i = p->options->borrowed_count; i < p->options->option_count;
+         ++i) {
+        opt_free(p, p->options->options[i].long_opt);
+        opt_free(p, p->options->options[i].description);
 #ifdef _WIN32
-        free(p->options->options[i].w32_translated);
+        opt_free(p, p->options->options[i].w32_translated);
 #endif
         /* I don't free struct optlib_option::argval here
            because it points to somewhere in argment buffer. */
     }
-    free(p->options->options);
-    free(p->options);
+    opt_free(p, p->options->options);
+    opt_free(p, p->options->long_index);
+    opt_free(p, p->options->seen);
+    opt_free(p, p->options->env_entries);
+    for (size_t i = 0; i < p->options->constraint_count; ++i) {
+        opt_free(p, p->options->constraints[i].mask);
+    }
+    opt_free(p, p->options->constraints);
+    config_free(p, &p->options->config);
+    unmap_file(p, p->options->snapshot_data, p->options->snapshot_size);
+    opt_free(p, p->options);
+    opt_free(p, p->env_prefix);
 #ifndef _WIN32
 #    ifdef HAVE_GETOPT_LONG
-    free(p->longopts);
+    opt_free(p, p->longopts);
 #    endif
 #    if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
-    free(p->shortopts);
+    opt_free(p, p->shortopts);
 #    endif
 #endif
+    /* the allocator lives in the parser being freed */
+    optlib_allocator allocator = p->allocator;
+    tracked_free(&allocator, &p->alloc_stats, p);
 }
 
 bool optlib_parser_add_option(optlib_parser *p, char const *long_opt,
@@ -124,8 +386,8 @@ bool optlib_parser_add_option(optlib_parser *p, char const *long_opt,
         } else {
             new_cap = p->options->option_capacity << 1;
         }
-        optlib_option *new_opts =
-            realloc(p->options->options, sizeof(optlib_option) * new_cap);
+        optlib_option *new_opts = opt_realloc(
+            p, p->options->options, sizeof(optlib_option) * new_cap);
         if (!new_opts) return false;
         p->options->options = new_opts;
         p->options->option_capacity = new_cap;
@@ -134,12 +396,11 @@ bool optlib_parser_add_option(optlib_parser *p, char const *long_opt,
     optlib_option *opt = p->options->options + p->options->option_count;
     memset(opt, 0, sizeof(optlib_option));
     if (long_opt) {
-        size_t len = strlen(long_opt) + 1;
-        opt->long_opt = malloc(len);
-        if (!opt->long_opt) return false;
-        memcpy(opt->long_opt, long_opt, len);
+        opt->long_opt = opt_strdup(p, long_opt);
+        if (!opt->long_opt) goto fail;
 #ifdef _WIN32
-        opt->w32_translated = translate_w32_option(long_opt);
+        opt->w32_translated = translate_w32_option(p, long_opt);
+        if (!opt->w32_translated) goto fail;
 #endif
     }
 
@@ -147,14 +408,757 @@ bool optlib_parser_add_option(optlib_parser *p, char const *long_opt,
     opt->has_arg = has_arg;
 
     if (description) {
-        size_t len = strlen(description) + 1;
-        opt->description = malloc(len);
-        if (!opt->description) return false;
-        memcpy(opt->description, description, len);
+        opt->description = opt_strdup(p, description);
+        if (!opt->description) goto fail;
     }
 
     p->options->option_count++;
     return true;
+
+fail:
+    opt_free(p, opt->long_opt);
+#ifdef _WIN32
+    opt_free(p, opt->w32_translated);
+#endif
+    return false;
+}
+
+/* The option set stays as it is, so shortopts, longopts and lookup tables
+   built by pre_parse_initialize() are reused by the next optlib_next()
+   call. */
+static void reset_parse_state(optlib_parser *p) {
+    p->finished = false;
+    for (size_t i = 0; i < p->options->option_count; ++i) {
+        p->options->options[i].argval = NULL;
+    }
+    p->options->stage = STAGE_ARGV;
+    if (p->options->seen) {
+        memset(p->options->seen, 0,
+               sizeof(unsigned long) * p->options->seen_words);
+    }
+    memset(&p->options->cursor, 0, sizeof(optlib_cursor));
+}
+
+bool optlib_parser_reset(optlib_parser *p, int argc, char **argv) {
+    if (argc <= 0) return false;
+
+    reset_parse_state(p);
+    p->argc = argc;
+#ifdef _WIN32
+    p->argc_internal = argc;
+#endif
+    p->argv = argv;
+#if !defined(_WIN32) && defined(HAVE_GETOPT_LONG)
+    /* optind = 0 makes getopt_long drop its internal state left by the
+       previous argument vector, e.g. half-consumed "-abc". */
+    p->optind = 0;
+#else
+    p->optind = 1;
+#endif
+
+    return true;
+}
+
+/* Splits line in place into NULL-terminated argv, removing quotes and
+   backslash escapes, and returns the number of tokens.  Returns -1 for an
+   unterminated quote, a trailing backslash or more than argv_size - 1
+   tokens, leaving line in an unspecified state. */
+int optlib_tokenize(char *line, char **argv, int argv_size) {
+    if (argv_size <= 0) return -1;
+
+    int argc = 0;
+    char *src = line;
+    for (;;) {
+        while (isspace((unsigned char)*src)) {
+            ++src;
+        }
+        if (!*src) break;
+        /* leave room for NULL sentinel */
+        if (argc + 1 >= argv_size) return -1;
+
+        /* Tokens only shrink when quotes and escapes are removed, so the
+           result is always written behind the read position. */
+        char *dst = src;
+        argv[argc++] = dst;
+        char quote = '\0';
+        for (; *src; ++src) {
+            if (quote) {
+                if (*src == quote) {
+                    quote = '\0';
+                    continue;
+                }
+                if (quote == '"' && *src == '\\' &&
+                    (src[1] == '"' || src[1] == '\\')) {
+                    ++src;
+                }
+                *dst++ = *src;
+            } else if (isspace((unsigned char)*src)) {
+                break;
+            } else if (*src == '\'' || *src == '"') {
+                quote = *src;
+            } else if (*src == '\\') {
+                if (!src[1]) return -1;
+                *dst++ = *++src;
+            } else {
+                *dst++ = *src;
+            }
+        }
+        if (quote) return -1;
+
+        bool at_end = !*src;
+        *dst = '\0';
+        if (at_end) break;
+        ++src;
+    }
+    argv[argc] = NULL;
+
+    return argc;
+}
+
+/* Resets p to the tokens of line.  Returns the result of optlib_tokenize(),
+   and leaves p as it is unless that is positive. */
+int optlib_parser_reset_line(optlib_parser *p, char *line, char **argv,
+                             int argv_size) {
+    int argc = optlib_tokenize(line, argv, argv_size);
+    if (argc > 0) {
+        optlib_parser_reset(p, argc, argv);
+    }
+    return argc;
+}
+
+/* Whether the first operand ends parsing, as with getopt, or getopt_long
+   when POSIXLY_CORRECT is set.  Read on reset, like getopt_long does. */
+static bool operand_ends_options(void) {
+#ifdef _WIN32
+    return false;
+#elif defined(HAVE_GETOPT_LONG)
+    return getenv("POSIXLY_CORRECT") != NULL;
+#else
+    return true;
+#endif
+}
+
+/* Parses tokens of buf, laid out like /proc/<pid>/cmdline, in place.  The
+   first token is the program name, and a trailing token without NUL is
+   ignored.  argval of options points into buf.  Options are matched as
+   getopt_long or getopt would match them, but buf is never permuted. */
+bool optlib_parser_reset_buffer(optlib_parser *p, char const *buf,
+                                size_t len) {
+    if (!len || !memchr(buf, '\0', len)) return false;
+
+    reset_parse_state(p);
+    p->argc = 0;
+#ifdef _WIN32
+    p->argc_internal = 0;
+#endif
+    p->argv = NULL;
+
+    optlib_cursor *c = &p->options->cursor;
+    c->active = true;
+    c->buf = buf;
+    c->len = len;
+    c->pos = strlen(buf) + 1;
+    c->stop_at_operand = operand_ends_options();
+    return true;
+}
+
+bool optlib_parser_set_env_prefix(optlib_parser *p, char const *prefix) {
+    char *new_prefix = NULL;
+    if (prefix) {
+        new_prefix = opt_strdup(p, prefix);
+        if (!new_prefix) return false;
+    }
+    opt_free(p, p->env_prefix);
+    p->env_prefix = new_prefix;
+    return true;
+}
+
+/* Option names are compared ignoring case and treating '_' as '-', so
+   that "log-level" can be looked up by "LOG_LEVEL". */
+static int fold_name_char(char c) {
+    if (c == '_') return '-';
+    return tolower((unsigned char)c);
+}
+
+static size_t hash_name(char const *name, size_t len) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (size_t)fold_name_char(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool name_equal(char const *a, size_t alen, char const *b,
+                       size_t blen) {
+    if (alen != blen) return false;
+    for (size_t i = 0; i < alen; ++i) {
+        if (fold_name_char(a[i]) != fold_name_char(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* With exact unset, names are matched as described above. */
+static optlib_option *find_long_option(optlib_options const *o,
+                                       char const *name, size_t len,
+                                       bool exact) {
+    if (!o->long_index_size) return NULL;
+
+    size_t mask = o->long_index_size - 1;
+    for (size_t slot = hash_name(name, len) & mask; o->long_index[slot];
+         slot = (slot + 1) & mask) {
+        optlib_option *opt = &o->options[o->long_index[slot] - 1];
+        if (exact) {
+            if (!strncmp(opt->long_opt, name, len) && !opt->long_opt[len]) {
+                return opt;
+            }
+        } else if (name_equal(opt->long_opt, strlen(opt->long_opt), name,
+                              len)) {
+            return opt;
+        }
+    }
+    return NULL;
+}
+
+static bool alloc_long_index(optlib_parser *p, size_t index_size) {
+    optlib_options *o = p->options;
+    size_t *new_index =
+        opt_realloc(p, o->long_index, sizeof(size_t) * index_size);
+    if (!new_index) return false;
+    o->long_index = new_index;
+    o->long_index_size = index_size;
+    memset(o->long_index, 0, sizeof(size_t) * index_size);
+    return true;
+}
+
+/* Allocates what a parse needs per option, apart from lookup tables. */
+static bool prepare_parse_state(optlib_parser *p) {
+    optlib_options *o = p->options;
+
+    size_t words = (o->option_count + SEEN_WORD_BITS - 1) / SEEN_WORD_BITS;
+    if (!words) words = 1;
+    unsigned long *new_seen =
+        opt_realloc(p, o->seen, sizeof(unsigned long) * words);
+    if (!new_seen) return false;
+    o->seen = new_seen;
+    o->seen_words = words;
+    memset(o->seen, 0, sizeof(unsigned long) * words);
+
+    size_t entries = o->option_count ? o->option_count : 1;
+    char **new_entries =
+        opt_realloc(p, o->env_entries, sizeof(char *) * entries);
+    if (!new_entries) return false;
+    o->env_entries = new_entries;
+
+    return true;
+}
+
+static bool prepare_lookup(optlib_parser *p) {
+    optlib_options *o = p->options;
+
+    size_t index_size = 1;
+    while (index_size < o->option_count * 2) {
+        index_size <<= 1;
+    }
+    if (!alloc_long_index(p, index_size)) return false;
+    for (size_t i = 0; i < o->option_count; ++i) {
+        char const *name = o->options[i].long_opt;
+        if (!name) continue;
+        size_t slot = hash_name(name, strlen(name)) & (index_size - 1);
+        while (o->long_index[slot]) {
+            slot = (slot + 1) & (index_size - 1);
+        }
+        /* 0 marks an empty slot */
+        o->long_index[slot] = i + 1;
+    }
+
+    memset(o->short_index, 0, sizeof(o->short_index));
+    for (size_t i = o->option_count; i > 0; --i) {
+        /* the first option wins, as with the linear lookup */
+        unsigned char ch = (unsigned char)o->options[i - 1].short_opt;
+        if (ch) {
+            o->short_index[ch] = i;
+        }
+    }
+
+    return prepare_parse_state(p);
+}
+
+static void set_seen(optlib_options *o, size_t i) {
+    o->seen[i / SEEN_WORD_BITS] |= 1UL << (i % SEEN_WORD_BITS);
+}
+
+static bool is_seen(optlib_options const *o, size_t i) {
+    return o->seen[i / SEEN_WORD_BITS] & (1UL << (i % SEEN_WORD_BITS));
+}
+
+static bool should_report(optlib_parser *p) {
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    return p->opterr;
+#else
+    (void)p;
+    return true;
+#endif
+}
+
+static char const *program_name(optlib_parser const *p) {
+    if (p->options->cursor.active) {
+        return p->options->cursor.buf;
+    }
+    return p->argv[0];
+}
+
+static void report_error(optlib_parser *p, char const *fmt, ...) {
+    if (!should_report(p)) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "%s: ", program_name(p));
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+/* Accepts the usual spellings of a boolean for options without argument. */
+static bool parse_flag_value(char const *value, size_t len, bool *result) {
+    static char const *const truthy[] = {"1", "true", "yes", "on"};
+    static char const *const falsy[] = {"", "0", "false", "no", "off"};
+    for (size_t i = 0; i < sizeof(truthy) / sizeof(*truthy); ++i) {
+        if (name_equal(truthy[i], strlen(truthy[i]), value, len)) {
+            *result = true;
+            return true;
+        }
+    }
+    for (size_t i = 0; i < sizeof(falsy) / sizeof(*falsy); ++i) {
+        if (name_equal(falsy[i], strlen(falsy[i]), value, len)) {
+            *result = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+static optlib_config_entry *find_config_entry(optlib_config *conf,
+                                              char const *name, size_t len) {
+    if (!conf->index_size) return NULL;
+
+    size_t mask = conf->index_size - 1;
+    for (size_t slot = hash_name(name, len) & mask; conf->index[slot];
+         slot = (slot + 1) & mask) {
+        optlib_config_entry *entry = &conf->entries[conf->index[slot] - 1];
+        if (name_equal(conf->data + entry->key_off, entry->key_len, name,
+                       len)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Scans the mapped file once, recording where each key and value is.
+   Values are trimmed and terminated only when they are looked up. */
+static bool index_config(optlib_parser *p, optlib_config *conf) {
+    size_t entry_cap = 0;
+    size_t line = 0;
+    size_t pos = 0;
+    while (pos < conf->size) {
+        ++line;
+        char const *start = conf->data + pos;
+        char const *nl = memchr(start, '\n', conf->size - pos);
+        size_t end = nl ? (size_t)(nl - conf->data) : conf->size;
+        size_t next = nl ? end + 1 : end;
+
+        while (pos < end && is_blank(conf->data[pos])) {
+            ++pos;
+        }
+        if (pos == end || conf->data[pos] == '#' || conf->data[pos] == ';') {
+            pos = next;
+            continue;
+        }
+        char const *eq = memchr(conf->data + pos, '=', end - pos);
+        if (!eq) {
+            report_error(p, "%s:%zu: expected 'key = value'", conf->path,
+                         line);
+            return false;
+        }
+        size_t key_end = (size_t)(eq - conf->data);
+        while (key_end > pos && is_blank(conf->data[key_end - 1])) {
+            --key_end;
+        }
+        if (key_end == pos) {
+            report_error(p, "%s:%zu: missing key", conf->path, line);
+            return false;
+        }
+
+        if (conf->entry_count == entry_cap) {
+            entry_cap = entry_cap ? entry_cap << 1 : 16;
+            optlib_config_entry *new_entries = opt_realloc(
+                p, conf->entries, sizeof(optlib_config_entry) * entry_cap);
+            if (!new_entries) return false;
+            conf->entries = new_entries;
+        }
+        optlib_config_entry *entry = &conf->entries[conf->entry_count++];
+        entry->key_off = pos;
+        entry->key_len = key_end - pos;
+        entry->value_off = (size_t)(eq - conf->data) + 1;
+        entry->value_end = end;
+        entry->line = line;
+        entry->value = NULL;
+
+        pos = next;
+    }
+
+    size_t index_size = 1;
+    while (index_size < conf->entry_count * 2) {
+        index_size <<= 1;
+    }
+    conf->index = opt_alloc(p, sizeof(size_t) * index_size);
+    if (!conf->index) return false;
+    memset(conf->index, 0, sizeof(size_t) * index_size);
+    conf->index_size = index_size;
+    for (size_t i = 0; i < conf->entry_count; ++i) {
+        optlib_config_entry *entry = &conf->entries[i];
+        size_t slot = hash_name(conf->data + entry->key_off, entry->key_len) &
+                      (index_size - 1);
+        for (; conf->index[slot]; slot = (slot + 1) & (index_size - 1)) {
+            optlib_config_entry *other = &conf->entries[conf->index[slot] - 1];
+            if (name_equal(conf->data + other->key_off, other->key_len,
+                           conf->data + entry->key_off, entry->key_len)) {
+                break;
+            }
+        }
+        /* later lines win over earlier ones */
+        conf->index[slot] = i + 1;
+    }
+
+    return true;
+}
+
+bool optlib_parser_load_config(optlib_parser *p, char const *path) {
+    optlib_config conf;
+    memset(&conf, 0, sizeof(optlib_config));
+
+    conf.path = opt_strdup(p, path);
+    if (!conf.path) return false;
+
+    if (!map_file(p, path, true, &conf.data, &conf.size)) {
+#ifdef _WIN32
+        report_error(p, "%s: cannot read file", path);
+#else
+        report_error(p, "%s: %s", path, strerror(errno));
+#endif
+        config_free(p, &conf);
+        return false;
+    }
+    if (!index_config(p, &conf)) {
+        config_free(p, &conf);
+        return false;
+    }
+
+    config_free(p, &p->options->config);
+    p->options->config = conf;
+    return true;
+}
+
+static char *resolve_config_value(optlib_parser *p, optlib_config *conf,
+                                  optlib_config_entry *entry) {
+    if (entry->value) return entry->value;
+
+    size_t begin = entry->value_off;
+    size_t end = entry->value_end;
+    while (begin < end && is_blank(conf->data[begin])) {
+        ++begin;
+    }
+    while (end > begin && is_blank(conf->data[end - 1])) {
+        --end;
+    }
+    if (end < conf->size) {
+        conf->data[end] = '\0';
+        entry->value = conf->data + begin;
+    } else {
+        char *value = opt_alloc(p, end - begin + 1);
+        if (!value) return NULL;
+        memcpy(value, conf->data + begin, end - begin);
+        value[end - begin] = '\0';
+        opt_free(p, conf->tail_value);
+        conf->tail_value = value;
+        entry->value = value;
+    }
+    return entry->value;
+}
+
+/* Walks environ once and remembers, for each option, the entry of
+   PREFIX_LONG_OPT.  Values are used in place. */
+static void collect_environment(optlib_parser *p) {
+    optlib_options *o = p->options;
+    memset(o->env_entries, 0, sizeof(char *) * o->option_count);
+    if (!p->env_prefix) return;
+
+    size_t prefix_len = strlen(p->env_prefix);
+    for (char **env = environ; *env; ++env) {
+        char *entry = *env;
+        if (strncmp(entry, p->env_prefix, prefix_len) ||
+            entry[prefix_len] != '_') {
+            continue;
+        }
+        char const *name = entry + prefix_len + 1;
+        char const *eq = strchr(name, '=');
+        if (!eq) continue;
+        optlib_option *opt =
+            find_long_option(o, name, (size_t)(eq - name), false);
+        if (opt) {
+            o->env_entries[opt - o->options] = entry;
+        }
+    }
+}
+
+/* Yields options given by overlay sources but not by argv.  Returns NULL
+   with *error set for a malformed value, and NULL with *error unset when
+   all options are consumed. */
+static optlib_option *next_overlay_option(optlib_parser *p, bool *error) {
+    optlib_options *o = p->options;
+    *error = false;
+    while (o->overlay_pos < o->option_count) {
+        size_t i = o->overlay_pos++;
+        if (is_seen(o, i)) continue;
+
+        optlib_option *opt = &o->options[i];
+        optlib_config_entry *entry = NULL;
+        char *value;
+        if (o->env_entries[i]) {
+            value = strchr(o->env_entries[i], '=') + 1;
+        } else if (opt->long_opt &&
+                   (entry = find_config_entry(&o->config, opt->long_opt,
+                                              strlen(opt->long_opt)))) {
+            value = resolve_config_value(p, &o->config, entry);
+            if (!value) {
+                *error = true;
+                return NULL;
+            }
+        } else {
+            continue;
+        }
+
+        if (opt->has_arg) {
+            if (!*value) {
+                if (entry) {
+                    report_error(p, "%s:%zu: missing value for '%s'",
+                                 o->config.path, entry->line, opt->long_opt);
+                } else {
+                    report_error(p,
+                                 "missing value in environment variable "
+                                 "'%.*s'",
+                                 (int)(value - 1 - o->env_entries[i]),
+                                 o->env_entries[i]);
+                }
+                *error = true;
+                return NULL;
+            }
+            opt->argval = value;
+        } else {
+            bool enabled;
+            if (!parse_flag_value(value, strlen(value), &enabled)) {
+                if (entry) {
+                    report_error(p, "%s:%zu: invalid boolean value for '%s'",
+                                 o->config.path, entry->line, opt->long_opt);
+                } else {
+                    report_error(p,
+                                 "invalid boolean value in environment "
+                                 "variable '%.*s'",
+                                 (int)(value - 1 - o->env_entries[i]),
+                                 o->env_entries[i]);
+                }
+                *error = true;
+                return NULL;
+            }
+            if (!enabled) continue;
+        }
+        set_seen(o, i);
+        return opt;
+    }
+    return NULL;
+}
+
+static optlib_option *find_option_by_name(optlib_parser *p,
+                                          char const *name) {
+    for (size_t i = 0; i < p->options->option_count; ++i) {
+        optlib_option *opt = &p->options->options[i];
+        if (opt->long_opt && !strcmp(opt->long_opt, name)) {
+            return opt;
+        }
+    }
+    if (name[0] && !name[1]) {
+        for (size_t i = 0; i < p->options->option_count; ++i) {
+            if (p->options->options[i].short_opt == name[0]) {
+                return &p->options->options[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Options are named by their long name, or by the option character for
+   options without one.  For OPTLIB_REQUIRES and OPTLIB_CONFLICTS, names[0]
+   is the constrained option and the rest are what it requires or
+   conflicts with. */
+bool optlib_parser_add_constraint(optlib_parser *p,
+                                  optlib_constraint_type type,
+                                  char const *const *names) {
+    size_t count = 0;
+    while (names[count]) {
+        ++count;
+    }
+    bool has_subject = type == OPTLIB_REQUIRES || type == OPTLIB_CONFLICTS;
+    if (count < (has_subject || type == OPTLIB_MUTUALLY_EXCLUSIVE ? 2 : 1)) {
+        return false;
+    }
+
+    size_t words = (p->options->option_count + SEEN_WORD_BITS - 1) /
+                   SEEN_WORD_BITS;
+    unsigned long *mask = opt_alloc(p, sizeof(unsigned long) * words);
+    if (!mask) return false;
+    memset(mask, 0, sizeof(unsigned long) * words);
+    size_t subject = 0;
+    for (size_t i = 0; i < count; ++i) {
+        optlib_option *opt = find_option_by_name(p, names[i]);
+        if (!opt) {
+            opt_free(p, mask);
+            return false;
+        }
+        size_t index = (size_t)(opt - p->options->options);
+        if (has_subject && i == 0) {
+            subject = index;
+        } else {
+            mask[index / SEEN_WORD_BITS] |= 1UL << (index % SEEN_WORD_BITS);
+        }
+    }
+
+    optlib_options *o = p->options;
+    if (o->constraint_capacity <= o->constraint_count) {
+        size_t new_cap = o->constraint_capacity ? o->constraint_capacity << 1
+                                                : 4;
+        optlib_constraint *new_constraints =
+            opt_realloc(p, o->constraints, sizeof(optlib_constraint) * new_cap);
+        if (!new_constraints) {
+            opt_free(p, mask);
+            return false;
+        }
+        o->constraints = new_constraints;
+        o->constraint_capacity = new_cap;
+    }
+    optlib_constraint *c = &o->constraints[o->constraint_count++];
+    c->type = type;
+    c->subject = subject;
+    c->mask = mask;
+    c->mask_words = words;
+    return true;
+}
+
+/* Checks one constraint against the bitset of seen options, a word at a
+   time. */
+static bool check_constraint(optlib_constraint const *c,
+                             unsigned long const *seen) {
+    bool subject_seen = seen[c->subject / SEEN_WORD_BITS] &
+                        (1UL << (c->subject % SEEN_WORD_BITS));
+    bool any = false;
+    for (size_t i = 0; i < c->mask_words; ++i) {
+        unsigned long given = seen[i] & c->mask[i];
+        switch (c->type) {
+        case OPTLIB_REQUIRED:
+            if (given != c->mask[i]) return false;
+            break;
+        case OPTLIB_MUTUALLY_EXCLUSIVE:
+            if (given && (any || (given & (given - 1)))) return false;
+            any |= given != 0;
+            break;
+        case OPTLIB_AT_LEAST_ONE:
+            if (given) return true;
+            break;
+        case OPTLIB_REQUIRES:
+            if (subject_seen && given != c->mask[i]) return false;
+            break;
+        case OPTLIB_CONFLICTS:
+            if (subject_seen && given) return false;
+            break;
+        }
+    }
+    return c->type != OPTLIB_AT_LEAST_ONE;
+}
+
+static void print_option_name(optlib_option const *opt, FILE *strm) {
+#ifdef _WIN32
+    fprintf(strm, "'-%s'", opt->w32_translated);
+#elif defined(HAVE_GETOPT_LONG)
+    if (opt->long_opt) {
+        fprintf(strm, "'--%s'", opt->long_opt);
+    } else {
+        fprintf(strm, "'-%c'", opt->short_opt);
+    }
+#else
+    fprintf(strm, "'-%c'", opt->short_opt);
+#endif
+}
+
+/* Prints options in the mask which are (or are not) in seen. */
+static void print_option_list(optlib_options const *o,
+                              optlib_constraint const *c,
+                              unsigned long const *seen, bool given,
+                              FILE *strm) {
+    bool first = true;
+    for (size_t i = 0; i < o->option_count; ++i) {
+        unsigned long bit = 1UL << (i % SEEN_WORD_BITS);
+        if (i / SEEN_WORD_BITS >= c->mask_words) break;
+        if (!(c->mask[i / SEEN_WORD_BITS] & bit)) continue;
+        if (seen) {
+            bool is_given = seen[i / SEEN_WORD_BITS] & bit;
+            if (is_given != given) continue;
+        }
+        if (!first) fputs(", ", strm);
+        print_option_name(&o->options[i], strm);
+        first = false;
+    }
+}
+
+static void report_constraint_error(optlib_parser *p,
+                                    optlib_constraint const *c) {
+    if (!should_report(p)) return;
+
+    optlib_options const *o = p->options;
+    fprintf(stderr, "%s: ", program_name(p));
+    switch (c->type) {
+    case OPTLIB_REQUIRED:
+        fputs("missing required option ", stderr);
+        print_option_list(o, c, o->seen, false, stderr);
+        break;
+    case OPTLIB_MUTUALLY_EXCLUSIVE:
+        fputs("options ", stderr);
+        print_option_list(o, c, o->seen, true, stderr);
+        fputs(" are mutually exclusive", stderr);
+        break;
+    case OPTLIB_AT_LEAST_ONE:
+        fputs("one of ", stderr);
+        print_option_list(o, c, NULL, true, stderr);
+        fputs(" is required", stderr);
+        break;
+    case OPTLIB_REQUIRES:
+        fputs("option ", stderr);
+        print_option_name(&o->options[c->subject], stderr);
+        fputs(" requires ", stderr);
+        print_option_list(o, c, o->seen, false, stderr);
+        break;
+    case OPTLIB_CONFLICTS:
+        fputs("option ", stderr);
+        print_option_name(&o->options[c->subject], stderr);
+        fputs(" conflicts with ", stderr);
+        print_option_list(o, c, o->seen, true, stderr);
+        break;
+    }
+    fputc('\n', stderr);
 }
 
 #ifdef HAVE_GETOPT_LONG
@@ -169,7 +1173,7 @@ static bool prepare_getopt_long(optlib_parser *p) {
     ++longcount;
 
     struct option *new_longopts =
-        realloc(p->longopts, sizeof(struct option) * longcount);
+        opt_realloc(p, p->longopts, sizeof(struct option) * longcount);
     if (!new_longopts) {
         return false;
     }
@@ -191,7 +1195,7 @@ static bool prepare_getopt_long(optlib_parser *p) {
 }
 #endif
 
-static bool pre_parse_initialize(optlib_parser *p) {
+static bool prepare_getopt(optlib_parser *p) {
 #if !defined(_WIN32) && (defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT))
 #    ifdef HAVE_GETOPT_LONG
     if (!prepare_getopt_long(p)) {
@@ -208,7 +1212,10 @@ static bool pre_parse_initialize(optlib_parser *p) {
         }
     }
 
-    char *new_shortopts = realloc(p->shortopts, shortlen);
+    /* for terminating NUL */
+    ++shortlen;
+
+    char *new_shortopts = opt_realloc(p, p->shortopts, shortlen);
     if (!new_shortopts) {
         return false;
     }
@@ -223,17 +1230,536 @@ static bool pre_parse_initialize(optlib_parser *p) {
         }
     }
     p->shortopts[off] = '\0';
+#else
+    (void)p;
 #endif
     return true;
 }
 
-optlib_option *optlib_next(optlib_parser *p) {
+static bool pre_parse_initialize(optlib_parser *p) {
+    if (!prepare_lookup(p)) {
+        return false;
+    }
+    return prepare_getopt(p);
+}
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+/* offset of an absent string */
+#define SNAPSHOT_NONE UINT32_MAX
+
+#ifdef _WIN32
+#    define SNAPSHOT_SYNTAX 3
+#elif defined(HAVE_GETOPT_LONG)
+#    define SNAPSHOT_SYNTAX 1
+#else
+#    define SNAPSHOT_SYNTAX 2
+#endif
+
+/* A snapshot is a header followed by option records, the long option
+   hash index, the short option index and strings.  Offsets are relative
+   to the start of the snapshot, so it can be used wherever it is
+   mapped. */
+typedef struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t syntax;
+    uint32_t byte_order;
+    uint32_t checksum;
+    uint32_t size;
+    uint32_t option_count;
+    uint32_t index_size;
+    uint32_t options_off;
+    uint32_t index_off;
+    uint32_t short_index_off;
+    uint32_t strings_off;
+} snapshot_header;
+
+typedef struct snapshot_option {
+    uint32_t long_opt;
+    uint32_t description;
+    uint32_t w32_translated;
+    uint32_t short_opt;
+    uint32_t has_arg;
+} snapshot_option;
+
+static char const snapshot_magic[8] = {'O', 'P', 'T', 'L', 'I', 'B', 'S', 'N'};
+
+static uint32_t snapshot_checksum(unsigned char const *data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t put_string(unsigned char *blob, size_t *off, char const *s) {
+    if (!s) return SNAPSHOT_NONE;
+
+    uint32_t result = (uint32_t)*off;
+    size_t len = strlen(s) + 1;
+    memcpy(blob + *off, s, len);
+    *off += len;
+    return result;
+}
+
+static void put_u32(unsigned char *blob, size_t off, size_t value) {
+    uint32_t v = (uint32_t)value;
+    memcpy(blob + off, &v, sizeof(uint32_t));
+}
+
+bool optlib_parser_save_snapshot(optlib_parser *p, char const *path) {
     if (!p->initialized) {
         if (!pre_parse_initialize(p)) {
-            return NULL;
+            return false;
         }
         p->initialized = true;
     }
+    optlib_options *o = p->options;
+
+    size_t strings_len = 0;
+    for (size_t i = 0; i < o->option_count; ++i) {
+        optlib_option const *opt = &o->options[i];
+        if (opt->long_opt) strings_len += strlen(opt->long_opt) + 1;
+        if (opt->description) strings_len += strlen(opt->description) + 1;
+#ifdef _WIN32
+        if (opt->w32_translated) {
+            strings_len += strlen(opt->w32_translated) + 1;
+        }
+#endif
+    }
+
+    size_t options_off = sizeof(snapshot_header);
+    size_t index_off = options_off + sizeof(snapshot_option) * o->option_count;
+    size_t short_index_off = index_off + sizeof(uint32_t) * o->long_index_size;
+    size_t strings_off = short_index_off + sizeof(uint32_t) * (UCHAR_MAX + 1);
+    size_t size = strings_off + strings_len;
+    if (size > UINT32_MAX) return false;
+
+    snapshot_header header;
+    memset(&header, 0, sizeof(snapshot_header));
+    memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = SNAPSHOT_VERSION;
+    header.syntax = SNAPSHOT_SYNTAX;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.size = (uint32_t)size;
+    header.option_count = (uint32_t)o->option_count;
+    header.index_size = (uint32_t)o->long_index_size;
+    header.options_off = (uint32_t)options_off;
+    header.index_off = (uint32_t)index_off;
+    header.short_index_off = (uint32_t)short_index_off;
+    header.strings_off = (uint32_t)strings_off;
+
+    unsigned char *blob = opt_alloc(p, size);
+    if (!blob) return false;
+    memset(blob, 0, size);
+    size_t string_pos = strings_off;
+    for (size_t i = 0; i < o->option_count; ++i) {
+        optlib_option const *opt = &o->options[i];
+        snapshot_option rec;
+        rec.long_opt = put_string(blob, &string_pos, opt->long_opt);
+        rec.description = put_string(blob, &string_pos, opt->description);
+#ifdef _WIN32
+        rec.w32_translated =
+            put_string(blob, &string_pos, opt->w32_translated);
+#else
+        rec.w32_translated = SNAPSHOT_NONE;
+#endif
+        rec.short_opt = (unsigned char)opt->short_opt;
+        rec.has_arg = opt->has_arg;
+        memcpy(blob + options_off + sizeof(snapshot_option) * i, &rec,
+               sizeof(snapshot_option));
+    }
+    for (size_t i = 0; i < o->long_index_size; ++i) {
+        put_u32(blob, index_off + sizeof(uint32_t) * i, o->long_index[i]);
+    }
+    for (size_t i = 0; i <= UCHAR_MAX; ++i) {
+        put_u32(blob, short_index_off + sizeof(uint32_t) * i,
+                o->short_index[i]);
+    }
+    header.checksum = snapshot_checksum(blob + sizeof(snapshot_header),
+                                        size - sizeof(snapshot_header));
+    memcpy(blob, &header, sizeof(snapshot_header));
+
+    FILE *f = fopen(path, "wb");
+    bool ok = f && fwrite(blob, 1, size, f) == size;
+    if (f && fclose(f)) ok = false;
+    opt_free(p, blob);
+    if (!ok) {
+        report_error(p, "%s: cannot write snapshot", path);
+    }
+    return ok;
+}
+
+static uint32_t read_u32(char const *data, size_t off) {
+    uint32_t value;
+    memcpy(&value, data + off, sizeof(uint32_t));
+    return value;
+}
+
+static bool valid_string(snapshot_header const *h, uint32_t off) {
+    /* the string area is checked to end with NUL */
+    return off == SNAPSHOT_NONE || (off >= h->strings_off && off < h->size);
+}
+
+static bool validate_snapshot(char const *data, size_t size,
+                              snapshot_header *h) {
+    if (size < sizeof(snapshot_header)) return false;
+    memcpy(h, data, sizeof(snapshot_header));
+    if (memcmp(h->magic, snapshot_magic, sizeof(snapshot_magic)) ||
+        h->version != SNAPSHOT_VERSION || h->syntax != SNAPSHOT_SYNTAX ||
+        h->byte_order != SNAPSHOT_BYTE_ORDER || h->size != size) {
+        return false;
+    }
+    if (h->checksum != snapshot_checksum((unsigned char const *)data +
+                                             sizeof(snapshot_header),
+                                         size - sizeof(snapshot_header))) {
+        return false;
+    }
+
+    uint64_t count = h->option_count;
+    if (h->index_size <= count || (h->index_size & (h->index_size - 1)) ||
+        h->options_off < sizeof(snapshot_header) ||
+        h->options_off + count * sizeof(snapshot_option) > h->index_off ||
+        h->index_off + (uint64_t)h->index_size * sizeof(uint32_t) >
+            h->short_index_off ||
+        h->short_index_off + (uint64_t)(UCHAR_MAX + 1) * sizeof(uint32_t) >
+            h->strings_off ||
+        h->strings_off > size) {
+        return false;
+    }
+    if (h->strings_off < size && data[size - 1]) return false;
+
+    for (uint32_t i = 0; i < h->option_count; ++i) {
+        snapshot_option rec;
+        memcpy(&rec, data + h->options_off + sizeof(snapshot_option) * i,
+               sizeof(snapshot_option));
+        if (!valid_string(h, rec.long_opt) ||
+            !valid_string(h, rec.description) ||
+            !valid_string(h, rec.w32_translated) ||
+            rec.short_opt > UCHAR_MAX || rec.has_arg > 1) {
+            return false;
+        }
+    }
+    /* find_long_option() probes until it reaches an empty slot */
+    bool has_empty = false;
+    for (uint32_t i = 0; i < h->index_size; ++i) {
+        uint32_t slot = read_u32(data, h->index_off + sizeof(uint32_t) * i);
+        if (slot > h->option_count) return false;
+        has_empty |= !slot;
+        /* find_long_option() expects every indexed option to have a name */
+        if (slot && read_u32(data, h->options_off +
+                                       sizeof(snapshot_option) * (slot - 1) +
+                                       offsetof(snapshot_option, long_opt)) ==
+                        SNAPSHOT_NONE) {
+            return false;
+        }
+    }
+    if (!has_empty) return false;
+    for (uint32_t i = 0; i <= UCHAR_MAX; ++i) {
+        uint32_t slot =
+            read_u32(data, h->short_index_off + sizeof(uint32_t) * i);
+        if (slot > h->option_count) return false;
+    }
+    return true;
+}
+
+static char *snapshot_string(char *data, uint32_t off) {
+    return off == SNAPSHOT_NONE ? NULL : data + off;
+}
+
+/* Loads a snapshot into a parser without options.  Strings are used where
+   they are mapped and lookup tables are taken as they are, so nothing is
+   copied per string or hashed again. */
+bool optlib_parser_load_snapshot(optlib_parser *p, char const *path) {
+    optlib_options *o = p->options;
+    if (o->option_count) return false;
+
+    char *data;
+    size_t size;
+    if (!map_file(p, path, false, &data, &size)) {
+        report_error(p, "%s: cannot read snapshot", path);
+        return false;
+    }
+    snapshot_header h;
+    if (!validate_snapshot(data, size, &h)) {
+        report_error(p, "%s: invalid or incompatible snapshot", path);
+        unmap_file(p, data, size);
+        return false;
+    }
+
+    if (o->option_capacity < h.option_count) {
+        optlib_option *new_opts =
+            opt_realloc(p, o->options, sizeof(optlib_option) * h.option_count);
+        if (!new_opts) {
+            unmap_file(p, data, size);
+            return false;
+        }
+        o->options = new_opts;
+        o->option_capacity = h.option_count;
+    }
+    if (!alloc_long_index(p, h.index_size)) {
+        unmap_file(p, data, size);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < h.option_count; ++i) {
+        snapshot_option rec;
+        memcpy(&rec, data + h.options_off + sizeof(snapshot_option) * i,
+               sizeof(snapshot_option));
+        optlib_option *opt = &o->options[i];
+        memset(opt, 0, sizeof(optlib_option));
+        opt->long_opt = snapshot_string(data, rec.long_opt);
+        opt->description = snapshot_string(data, rec.description);
+#ifdef _WIN32
+        opt->w32_translated = snapshot_string(data, rec.w32_translated);
+#endif
+        opt->short_opt = (char)rec.short_opt;
+        opt->has_arg = rec.has_arg;
+    }
+    o->option_count = h.option_count;
+    o->borrowed_count = h.option_count;
+    for (uint32_t i = 0; i < h.index_size; ++i) {
+        o->long_index[i] = read_u32(data, h.index_off + sizeof(uint32_t) * i);
+    }
+    for (size_t i = 0; i <= UCHAR_MAX; ++i) {
+        o->short_index[i] =
+            read_u32(data, h.short_index_off + sizeof(uint32_t) * i);
+    }
+
+    if (!prepare_parse_state(p) || !prepare_getopt(p)) {
+        /* lookup tables are rebuilt before the next parse */
+        o->option_count = 0;
+        o->borrowed_count = 0;
+        p->initialized = false;
+        unmap_file(p, data, size);
+        return false;
+    }
+    unmap_file(p, o->snapshot_data, o->snapshot_size);
+    o->snapshot_data = data;
+    o->snapshot_size = size;
+    p->initialized = true;
+    return true;
+}
+
+enum {
+    CURSOR_END = -1,
+    CURSOR_ERROR = -2,
+};
+
+/* Returns the NUL-terminated token at pos and the position of the one
+   after it, or NULL past the last complete token.  Positions are byte
+   offsets into a buffer, or indices into argv. */
+static char const *cursor_token(optlib_cursor const *c, size_t pos,
+                                size_t *next) {
+    if (c->argv) {
+        if (pos >= (size_t)c->argc) return NULL;
+        *next = pos + 1;
+        return c->argv[pos];
+    }
+    if (pos >= c->len) return NULL;
+    char const *end = memchr(c->buf + pos, '\0', c->len - pos);
+    if (!end) return NULL;
+    *next = (size_t)(end - c->buf) + 1;
+    return c->buf + pos;
+}
+
+static long cursor_error(optlib_cursor *c, int error, char const *token,
+                         char ch) {
+    c->error = error;
+    c->error_pos = c->token_pos;
+    c->error_token = token;
+    c->error_char = ch;
+    return CURSOR_ERROR;
+}
+
+#if !defined(_WIN32) && defined(HAVE_GETOPT_LONG)
+/* Matches "--name" exactly or by prefix, as getopt_long does with the
+   longopts built by prepare_getopt_long().  A prefix of several options is
+   only ambiguous if they differ in has_arg, since they all share flag and
+   val; otherwise the first one wins. */
+static long match_long_option(optlib_options const *o, char const *name,
+                              size_t len) {
+    optlib_option const *opt = find_long_option(o, name, len, true);
+    if (opt) return (long)(opt - o->options);
+
+    long found = CURSOR_END;
+    for (size_t i = 0; i < o->option_count; ++i) {
+        char const *long_opt = o->options[i].long_opt;
+        if (long_opt && !strncmp(long_opt, name, len)) {
+            if (found == CURSOR_END) {
+                found = (long)i;
+            } else if (o->options[i].has_arg != o->options[found].has_arg) {
+                return CURSOR_ERROR;
+            }
+        }
+    }
+    return found;
+}
+#endif
+
+/* Reentrant counterpart of getopt over a cursor, following the option
+   syntax of the platform.  Operands are skipped where getopt_long would
+   permute them, and end parsing where getopt would stop.  Returns the
+   option index, CURSOR_END, or CURSOR_ERROR with c->error set. */
+static long cursor_next(optlib_options const *o, optlib_cursor *c,
+                        char const **argval) {
+    *argval = NULL;
+    size_t next;
+    char const *token;
+    for (;;) {
+        token = cursor_token(c, c->pos, &next);
+        if (!token) return CURSOR_END;
+        c->token = token;
+        c->token_pos = c->pos;
+        if (c->cluster) break;
+
+        if (token[0] != '-' || !token[1]) {
+            if (c->stop_at_operand) return CURSOR_END;
+            c->pos = next;
+            continue;
+        }
+        if (!strcmp(token, "--")) {
+            c->pos = SIZE_MAX;
+            return CURSOR_END;
+        }
+        c->pos = next;
+
+#ifdef _WIN32
+        long index = CURSOR_END;
+        for (size_t i = 0; i < o->option_count; ++i) {
+            char const *name = o->options[i].w32_translated;
+            if (name && !strcmp(name, token + 1)) {
+                index = (long)i;
+                break;
+            }
+        }
+        if (index == CURSOR_END) {
+            return cursor_error(c, OPTLIB_ERROR_UNRECOGNIZED_OPTION, token, 0);
+        }
+        if (o->options[index].has_arg) {
+            char const *arg = cursor_token(c, c->pos, &next);
+            if (!arg || arg[0] == '-') {
+                return cursor_error(c, OPTLIB_ERROR_MISSING_ARGUMENT, token, 0);
+            }
+            c->pos = next;
+            *argval = arg;
+        }
+        return index;
+#else
+#    ifdef HAVE_GETOPT_LONG
+        if (token[1] == '-') {
+            char const *name = token + 2;
+            char const *eq = strchr(name, '=');
+            size_t len = eq ? (size_t)(eq - name) : strlen(name);
+            long index = match_long_option(o, name, len);
+            if (index == CURSOR_END) {
+                return cursor_error(c, OPTLIB_ERROR_UNRECOGNIZED_OPTION,
+                                    token, 0);
+            }
+            if (index == CURSOR_ERROR) {
+                return cursor_error(c, OPTLIB_ERROR_AMBIGUOUS_OPTION, token, 0);
+            }
+            if (!o->options[index].has_arg) {
+                if (eq) {
+                    return cursor_error(c, OPTLIB_ERROR_UNEXPECTED_ARGUMENT,
+                                        token, 0);
+                }
+            } else if (eq) {
+                *argval = eq + 1;
+            } else {
+                char const *arg = cursor_token(c, c->pos, &next);
+                if (!arg) {
+                    return cursor_error(c, OPTLIB_ERROR_MISSING_ARGUMENT,
+                                        token, 0);
+                }
+                c->pos = next;
+                *argval = arg;
+            }
+            return index;
+        }
+#    endif
+        /* back to the start of "-abc" */
+        c->pos = c->token_pos;
+        c->cluster = 1;
+        break;
+#endif
+    }
+
+    char ch = token[c->cluster++];
+    if (!token[c->cluster]) {
+        c->cluster = 0;
+        c->pos = next;
+    }
+    size_t index = o->short_index[(unsigned char)ch];
+    if (!index) {
+        return cursor_error(c, OPTLIB_ERROR_INVALID_OPTION, token, ch);
+    }
+    if (o->options[index - 1].has_arg) {
+        if (c->cluster) {
+            *argval = token + c->cluster;
+            c->cluster = 0;
+            c->pos = next;
+        } else {
+            char const *arg = cursor_token(c, c->pos, &next);
+            if (!arg) {
+                return cursor_error(c, OPTLIB_ERROR_MISSING_ARGUMENT, token,
+                                    ch);
+            }
+            c->pos = next;
+            *argval = arg;
+        }
+    }
+    return (long)index - 1;
+}
+
+static optlib_option *next_cursor_option(optlib_parser *p) {
+    optlib_cursor *c = &p->options->cursor;
+    char const *argval;
+    long index = cursor_next(p->options, c, &argval);
+    if (index == CURSOR_END) {
+        p->finished = true;
+        return NULL;
+    }
+    if (index >= 0) {
+        optlib_option *opt = &p->options->options[index];
+        if (argval) {
+            /* never written through; the buffer is only read */
+            opt->argval = (char *)argval;
+        }
+        return opt;
+    }
+
+    switch (c->error) {
+    case OPTLIB_ERROR_INVALID_OPTION:
+        report_error(p, "invalid option -- '%c'", c->error_char);
+        break;
+    case OPTLIB_ERROR_UNRECOGNIZED_OPTION:
+        report_error(p, "unrecognized option '%s'", c->error_token);
+        break;
+    case OPTLIB_ERROR_AMBIGUOUS_OPTION:
+        report_error(p, "option '%s' is ambiguous", c->error_token);
+        break;
+    case OPTLIB_ERROR_MISSING_ARGUMENT:
+        if (c->error_char) {
+            report_error(p, "option requires an argument -- '%c'",
+                         c->error_char);
+        } else {
+            report_error(p, "option '%s' requires an argument",
+                         c->error_token);
+        }
+        break;
+    case OPTLIB_ERROR_UNEXPECTED_ARGUMENT:
+        report_error(p, "option '%.*s' doesn't allow an argument",
+                     (int)(strchr(c->error_token, '=') - c->error_token),
+                     c->error_token);
+        break;
+    }
+    return NULL;
+}
+
+static optlib_option *next_argv_option(optlib_parser *p) {
 #if !defined(_WIN32) && (defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT))
     optind = p->optind;
     opterr = p->opterr;
@@ -300,6 +1826,12 @@ retry:
                 break;
             }
         }
+    } else {
+        /* longindex points into longopts, which skips short-only options */
+        char const *name = p->longopts[longindex].name;
+        longindex =
+            (int)(find_long_option(p->options, name, strlen(name), true) -
+                  p->options->options);
     }
     if (p->options->options[longindex].has_arg) {
         if (!optarg) {
@@ -337,6 +1869,300 @@ retry:
     return NULL;
 }
 
+optlib_option *optlib_next(optlib_parser *p) {
+    if (!p->initialized) {
+        if (!pre_parse_initialize(p)) {
+            return NULL;
+        }
+        p->initialized = true;
+    }
+
+    optlib_options *o = p->options;
+    if (o->stage == STAGE_ARGV) {
+        optlib_option *opt = o->cursor.active ? next_cursor_option(p)
+                                              : next_argv_option(p);
+        if (opt) {
+            set_seen(o, (size_t)(opt - o->options));
+            return opt;
+        }
+        if (!p->finished) return NULL;
+
+        p->finished = false;
+        o->stage = STAGE_OVERLAY;
+        o->overlay_pos = 0;
+        collect_environment(p);
+    }
+
+    if (o->stage == STAGE_OVERLAY) {
+        bool error;
+        optlib_option *opt = next_overlay_option(p, &error);
+        if (opt || error) return opt;
+
+        o->stage = STAGE_CONSTRAINTS;
+        o->constraint_pos = 0;
+    }
+
+    /* report violated constraints one by one, as getopt does for unknown
+       options */
+    while (o->constraint_pos < o->constraint_count) {
+        optlib_constraint const *c = &o->constraints[o->constraint_pos++];
+        if (!check_constraint(c, o->seen)) {
+            report_constraint_error(p, c);
+            return NULL;
+        }
+    }
+
+    p->finished = true;
+    return NULL;
+}
+
+#ifdef _WIN32
+#    define BATCH_THREADS
+typedef volatile LONG64 batch_counter;
+typedef HANDLE batch_thread;
+
+static void batch_counter_init(batch_counter *counter, size_t value) {
+    *counter = (LONG64)value;
+}
+
+static size_t batch_claim(batch_counter *counter, size_t n) {
+    return (size_t)InterlockedExchangeAdd64(counter, (LONG64)n);
+}
+#elif defined(HAVE_PTHREAD) && defined(HAVE_STDATOMIC_H)
+#    define BATCH_THREADS
+typedef atomic_size_t batch_counter;
+typedef pthread_t batch_thread;
+
+static void batch_counter_init(batch_counter *counter, size_t value) {
+    atomic_init(counter, value);
+}
+
+static size_t batch_claim(batch_counter *counter, size_t n) {
+    /* results are published by joining the threads */
+    return atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+#else
+typedef size_t batch_counter;
+
+static void batch_counter_init(batch_counter *counter, size_t value) {
+    *counter = value;
+}
+
+static size_t batch_claim(batch_counter *counter, size_t n) {
+    size_t result = *counter;
+    *counter += n;
+    return result;
+}
+#endif
+
+/* vectors claimed at a time, from a worker's own queue or another's */
+#define BATCH_CHUNK 16
+/* Queues and seen sets of different workers are kept on separate cache
+   lines, so that claiming and parsing do not write to shared lines. */
+#define BATCH_LINE 64
+
+typedef struct batch_queue {
+    batch_counter next;
+    size_t end;
+    char pad[BATCH_LINE - sizeof(batch_counter) - sizeof(size_t)];
+} batch_queue;
+
+typedef struct batch_job {
+    optlib_options const *options;
+    optlib_argv const *vectors;
+    char const **values;
+    optlib_batch_result *results;
+    batch_queue *queues;
+    unsigned workers;
+    /* read once, as getenv() may race with the caller's setenv() */
+    bool stop_at_operand;
+} batch_job;
+
+typedef struct batch_worker {
+    batch_job const *job;
+    unsigned id;
+    unsigned long *seen;
+} batch_worker;
+
+/* Parses one vector touching nothing but its own outputs and seen, so that
+   workers never share writable state. */
+static void parse_vector(optlib_options const *o, optlib_argv const *v,
+                         bool stop_at_operand, unsigned long *seen,
+                         char const **values, optlib_batch_result *r) {
+    memset(seen, 0, sizeof(unsigned long) * o->seen_words);
+    if (values) {
+        memset(values, 0, sizeof(char const *) * o->option_count);
+    }
+    r->error = OPTLIB_ERROR_NONE;
+    r->error_index = 0;
+    r->constraint = 0;
+
+    optlib_cursor c;
+    memset(&c, 0, sizeof(optlib_cursor));
+    c.argv = v->argv;
+    c.argc = v->argc;
+    c.pos = 1;
+    c.stop_at_operand = stop_at_operand;
+    for (;;) {
+        char const *argval;
+        long index = cursor_next(o, &c, &argval);
+        if (index == CURSOR_END) break;
+        if (index == CURSOR_ERROR) {
+            r->error = (optlib_error)c.error;
+            r->error_index = c.error_pos;
+            return;
+        }
+        seen[index / SEEN_WORD_BITS] |= 1UL << (index % SEEN_WORD_BITS);
+        if (values) {
+            /* options without argument get the token they were given in */
+            values[index] = argval ? argval : c.token;
+        }
+    }
+
+    for (size_t i = 0; i < o->constraint_count; ++i) {
+        if (!check_constraint(&o->constraints[i], seen)) {
+            r->error = OPTLIB_ERROR_CONSTRAINT;
+            r->constraint = i;
+            return;
+        }
+    }
+}
+
+static void run_batch_worker(batch_worker *w) {
+    batch_job const *job = w->job;
+    size_t option_count = job->options->option_count;
+    /* Drain the own queue first, then steal from the others.  Queues are
+       never refilled, so one pass over them is enough. */
+    for (unsigned k = 0; k < job->workers; ++k) {
+        batch_queue *q = &job->queues[(w->id + k) % job->workers];
+        for (;;) {
+            size_t begin = batch_claim(&q->next, BATCH_CHUNK);
+            if (begin >= q->end) break;
+            size_t end = q->end - begin < BATCH_CHUNK ? q->end
+                                                      : begin + BATCH_CHUNK;
+            for (size_t i = begin; i < end; ++i) {
+                parse_vector(job->options, &job->vectors[i],
+                             job->stop_at_operand, w->seen,
+                             job->values ? job->values + i * option_count
+                                         : NULL,
+                             &job->results[i]);
+            }
+        }
+    }
+}
+
+#ifdef BATCH_THREADS
+#    ifdef _WIN32
+static DWORD WINAPI batch_thread_main(LPVOID arg) {
+    run_batch_worker(arg);
+    return 0;
+}
+
+static bool batch_spawn(batch_thread *thread, batch_worker *w) {
+    *thread = CreateThread(NULL, 0, &batch_thread_main, w, 0, NULL);
+    return *thread != NULL;
+}
+
+static void batch_join(batch_thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#    else
+static void *batch_thread_main(void *arg) {
+    run_batch_worker(arg);
+    return NULL;
+}
+
+static bool batch_spawn(batch_thread *thread, batch_worker *w) {
+    return !pthread_create(thread, NULL, &batch_thread_main, w);
+}
+
+static void batch_join(batch_thread thread) {
+    pthread_join(thread, NULL);
+}
+#    endif
+#endif
+
+/* Parses count argument vectors against the options and constraints of p
+   on up to workers threads.  Options are matched as optlib_next() matches
+   them, but environment and configuration file overlays are not applied,
+   and vectors are never permuted.  If values is not NULL, it receives
+   option_count entries per vector: argval (or the option token for options
+   without argument) of each option given, and NULL for the others. */
+bool optlib_parse_batch(optlib_parser *p, optlib_argv const *vectors,
+                        size_t count, char const **values,
+                        optlib_batch_result *results, unsigned workers) {
+    if (!p->initialized) {
+        if (!pre_parse_initialize(p)) {
+            return false;
+        }
+        p->initialized = true;
+    }
+    if (!count) return true;
+
+#ifndef BATCH_THREADS
+    workers = 1;
+#endif
+    if (!workers) workers = 1;
+    if (workers > count) workers = (unsigned)count;
+
+    /* allocate up front, as the allocator may not be thread-safe */
+    optlib_options const *o = p->options;
+    size_t seen_stride = (sizeof(unsigned long) * o->seen_words +
+                          BATCH_LINE - 1) / BATCH_LINE * BATCH_LINE;
+    char *scratch = opt_alloc(p, BATCH_LINE - 1 + (sizeof(batch_queue) +
+                                                    seen_stride) * workers);
+    batch_worker *ws = opt_alloc(p, sizeof(batch_worker) * workers);
+#ifdef BATCH_THREADS
+    batch_thread *threads = opt_alloc(p, sizeof(batch_thread) * workers);
+    bool ok = scratch && ws && threads;
+#else
+    bool ok = scratch && ws;
+#endif
+
+    if (ok) {
+        /* start at the first cache line boundary in scratch */
+        size_t skew = (uintptr_t)scratch % BATCH_LINE;
+        char *line = scratch + (skew ? BATCH_LINE - skew : 0);
+        batch_queue *queues = (batch_queue *)line;
+        char *seen = line + sizeof(batch_queue) * workers;
+
+        batch_job job = {o, vectors, values, results, queues, workers,
+                         operand_ends_options()};
+        for (unsigned i = 0; i < workers; ++i) {
+            batch_counter_init(&queues[i].next, count * i / workers);
+            queues[i].end = count * (i + 1) / workers;
+            ws[i].job = &job;
+            ws[i].id = i;
+            ws[i].seen = (unsigned long *)(seen + seen_stride * i);
+        }
+
+        unsigned spawned = 0;
+#ifdef BATCH_THREADS
+        /* if a thread cannot be started, its queue is stolen by others */
+        while (spawned + 1 < workers &&
+               batch_spawn(&threads[spawned], &ws[spawned + 1])) {
+            ++spawned;
+        }
+#endif
+        run_batch_worker(&ws[0]);
+#ifdef BATCH_THREADS
+        for (unsigned i = 0; i < spawned; ++i) {
+            batch_join(threads[i]);
+        }
+#else
+        (void)spawned;
+#endif
+    }
+
+#ifdef BATCH_THREADS
+    opt_free(p, threads);
+#endif
+    opt_free(p, ws);
+    opt_free(p, scratch);
+    return ok;
+}
+
 void optlib_print_help(optlib_parser *p, FILE *strm) {
 #ifdef _WIN32
     size_t padding = 0;
@@ -463,14 +2289,52 @@ void optlib_print_help(optlib_parser *p, FILE *strm) {
 #ifdef TEST
 #    include "test_util.h"
 
+static bool translates_to(optlib_parser *p, char const *long_opt,
+                          char const *expected) {
+    char *translated = translate_w32_option(p, long_opt);
+    bool result = !strcmp(translated, expected);
+    opt_free(p, translated);
+    return result;
+}
+
+/* Saves p as a snapshot whose long option index has no empty slot. */
+static bool save_full_index_snapshot(optlib_parser *p, char const *path) {
+    if (!optlib_parser_save_snapshot(p, path)) return false;
+    char *data;
+    size_t size;
+    if (!map_file(p, path, false, &data, &size)) return false;
+    unsigned char *blob = opt_alloc(p, size);
+    if (blob) memcpy(blob, data, size);
+    unmap_file(p, data, size);
+    if (!blob) return false;
+
+    snapshot_header h;
+    memcpy(&h, blob, sizeof(snapshot_header));
+    for (uint32_t i = 0; i < h.index_size; ++i) {
+        put_u32(blob, h.index_off + sizeof(uint32_t) * i, 1);
+    }
+    h.checksum = snapshot_checksum(blob + sizeof(snapshot_header),
+                                   size - sizeof(snapshot_header));
+    memcpy(blob, &h, sizeof(snapshot_header));
+
+    FILE *f = fopen(path, "wb");
+    bool ok = f && fwrite(blob, 1, size, f) == size;
+    if (f && fclose(f)) ok = false;
+    opt_free(p, blob);
+    return ok;
+}
+
 int main(void) {
-    test_assert(!strcmp(translate_w32_option("foo-bar"), "FooBar"));
-    test_assert(!strcmp(translate_w32_option("foo--bar"), "FooBar"));
-    test_assert(!strcmp(translate_w32_option("foo-bar-"), "FooBar"));
-    test_assert(!strcmp(translate_w32_option("-foo-bar"), "FooBar"));
-    test_assert(!strcmp(translate_w32_option("1-2"), "12"));
-    test_assert(!strcmp(translate_w32_option("?"), "?"));
-    test_assert(!strcmp(translate_w32_option("-"), ""));
+    char *argv0[] = {"progname", 0};
+    optlib_parser *p = optlib_parser_new(1, argv0);
+    test_assert(translates_to(p, "foo-bar", "FooBar"));
+    test_assert(translates_to(p, "foo--bar", "FooBar"));
+    test_assert(translates_to(p, "foo-bar-", "FooBar"));
+    test_assert(translates_to(p, "-foo-bar", "FooBar"));
+    test_assert(translates_to(p, "1-2", "12"));
+    test_assert(translates_to(p, "?", "?"));
+    test_assert(translates_to(p, "-", ""));
+    optlib_parser_free(p);
 
 #    ifdef _WIN32
     char *argv1[] = {"progname", "-Foo", "bar", 0};
@@ -490,6 +2354,17 @@ int main(void) {
     test_assert(opt->argval);
     test_assert(!strcmp(opt->argval, "bar"));
     optlib_print_help(parser, stdout);
+
+    /* a full index would make failed lookups probe forever */
+    char const *path = "optlib_test_builtin.snapshot";
+    test_assert(save_full_index_snapshot(parser, path));
+    optlib_parser *loaded = optlib_parser_new(1, argv0);
+#    if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    loaded->opterr = 0;
+#    endif
+    test_assert(!optlib_parser_load_snapshot(loaded, path));
+    optlib_parser_free(loaded);
+    remove(path);
     optlib_parser_free(parser);
 
     puts("All tests passed.");
@@ -56,6 +56,54 @@ typedef struct optlib_option {
 
 struct optlib_options;
 
+/* Sizes passed to resize and release are those given when the block was
+   allocated.  A NULL allocator selects malloc, realloc and free. */
+typedef struct optlib_allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*resize)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+    void (*release)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+} optlib_allocator;
+
+typedef struct optlib_alloc_stats {
+    /* successful alloc and resize calls */
+    size_t allocations;
+    size_t live_allocations;
+    size_t current_bytes;
+    size_t peak_bytes;
+} optlib_alloc_stats;
+
+typedef enum optlib_error {
+    OPTLIB_ERROR_NONE,
+    OPTLIB_ERROR_INVALID_OPTION,
+    OPTLIB_ERROR_UNRECOGNIZED_OPTION,
+    OPTLIB_ERROR_AMBIGUOUS_OPTION,
+    OPTLIB_ERROR_MISSING_ARGUMENT,
+    OPTLIB_ERROR_UNEXPECTED_ARGUMENT,
+    OPTLIB_ERROR_CONSTRAINT,
+} optlib_error;
+
+typedef struct optlib_argv {
+    int argc;
+    char **argv;
+} optlib_argv;
+
+typedef struct optlib_batch_result {
+    optlib_error error;
+    /* argv index of the offending token */
+    size_t error_index;
+    /* index of the violated constraint, in order of declaration */
+    size_t constraint;
+} optlib_batch_result;
+
+typedef enum optlib_constraint_type {
+    OPTLIB_REQUIRED,
+    OPTLIB_MUTUALLY_EXCLUSIVE,
+    OPTLIB_AT_LEAST_ONE,
+    OPTLIB_REQUIRES,
+    OPTLIB_CONFLICTS,
+} optlib_constraint_type;
+
 typedef struct optlib_parser {
     struct optlib_options *options;
     int argc;
@@ -66,6 +114,9 @@ typedef struct optlib_parser {
 #endif
     bool initialized;
     bool finished;
+    char *env_prefix;
+    optlib_allocator allocator;
+    optlib_alloc_stats alloc_stats;
 #ifndef _WIN32
 #    ifdef HAVE_GETOPT_LONG
     struct option *longopts;
@@ -80,11 +131,29 @@ typedef struct optlib_parser {
 } optlib_parser;
 
 optlib_parser *optlib_parser_new(int argc, char **argv);
+optlib_parser *optlib_parser_new_with_allocator(int argc, char **argv,
+                                                optlib_allocator const *a);
 void optlib_parser_free(optlib_parser *p);
 bool optlib_parser_add_option(optlib_parser *p, char const *long_opt,
                               char const short_opt, bool const has_arg,
                               char const *description);
+bool optlib_parser_reset(optlib_parser *p, int argc, char **argv);
+bool optlib_parser_add_constraint(optlib_parser *p,
+                                  optlib_constraint_type type,
+                                  char const *const *names);
+bool optlib_parser_set_env_prefix(optlib_parser *p, char const *prefix);
+bool optlib_parser_load_config(optlib_parser *p, char const *path);
+int optlib_tokenize(char *line, char **argv, int argv_size);
+int optlib_parser_reset_line(optlib_parser *p, char *line, char **argv,
+                             int argv_size);
+bool optlib_parser_reset_buffer(optlib_parser *p, char const *buf,
+                                size_t len);
+bool optlib_parser_save_snapshot(optlib_parser *p, char const *path);
+bool optlib_parser_load_snapshot(optlib_parser *p, char const *path);
 optlib_option *optlib_next(optlib_parser *p);
+bool optlib_parse_batch(optlib_parser *p, optlib_argv const *vectors,
+                        size_t count, char const **values,
+                        optlib_batch_result *results, unsigned workers);
 void optlib_print_help(optlib_parser *p, FILE *strm);
 
 END_DECL;
@@ -18,12 +18,95 @@
 #ifndef OPTLIB_INTERNAL_H
 #define OPTLIB_INTERNAL_H
 
+#include <limits.h>
+#include <stdbool.h>
 #include <stddef.h>
 
+typedef struct optlib_constraint {
+    int type;
+    /* the option constrained by OPTLIB_REQUIRES and OPTLIB_CONFLICTS */
+    size_t subject;
+    /* bitset of the other options in the constraint */
+    unsigned long *mask;
+    size_t mask_words;
+} optlib_constraint;
+
+typedef struct optlib_config_entry {
+    size_t key_off;
+    size_t key_len;
+    /* untrimmed text after '=' up to end of line */
+    size_t value_off;
+    size_t value_end;
+    size_t line;
+    /* NUL-terminated value, resolved on first use */
+    char *value;
+} optlib_config_entry;
+
+typedef struct optlib_config {
+    char *path;
+    /* private (copy-on-write) mapping of the file */
+    char *data;
+    size_t size;
+    optlib_config_entry *entries;
+    size_t entry_count;
+    /* open-addressed hash of keys; holds entry index + 1 */
+    size_t *index;
+    size_t index_size;
+    /* copy of a value ending at EOF, where no room is left for NUL */
+    char *tail_value;
+} optlib_config;
+
+/* Position in a NUL-separated argument buffer or an argv array, parsed
+   without getopt. */
+typedef struct optlib_cursor {
+    bool active;
+    char const *buf;
+    size_t len;
+    /* set instead of buf when tokens come from argv */
+    char *const *argv;
+    int argc;
+    /* offset (or argv index) of the next token to read */
+    size_t pos;
+    /* offset of the next option character in "-abc", or 0 */
+    size_t cluster;
+    /* operands end parsing instead of being skipped */
+    bool stop_at_operand;
+    /* the token last read and its position */
+    char const *token;
+    size_t token_pos;
+    int error;
+    size_t error_pos;
+    char const *error_token;
+    char error_char;
+} optlib_cursor;
+
 typedef struct optlib_options {
     struct optlib_option *options;
     size_t option_count;
     size_t option_capacity;
+    /* open-addressed hash of long option names; holds index + 1 */
+    size_t *long_index;
+    size_t long_index_size;
+    /* index + 1 of the option for each option character */
+    size_t short_index[UCHAR_MAX + 1];
+    /* bitset of options given while parsing */
+    unsigned long *seen;
+    size_t seen_words;
+    /* "PREFIX_NAME=value" entries of environ, indexed by option */
+    char **env_entries;
+    optlib_constraint *constraints;
+    size_t constraint_count;
+    size_t constraint_capacity;
+    optlib_config config;
+    /* mapped snapshot, which the strings of the first borrowed_count
+       options point into */
+    char *snapshot_data;
+    size_t snapshot_size;
+    size_t borrowed_count;
+    optlib_cursor cursor;
+    int stage;
+    size_t overlay_pos;
+    size_t constraint_pos;
 } optlib_options;
 
 #endif
@@ -19,6 +19,7 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "optlib.h"
@@ -158,8 +159,926 @@ bool test_case_1() {
     return true;
 }
 
+bool test_case_2() {
+#ifdef _WIN32
+    char line0[] = "get -Key 'foo bar' -Verbose";
+    char line1[] = "get \"a\\\"b\" -Key c\\ d";
+#elif defined(HAVE_GETOPT_LONG)
+    char line0[] = "get --key 'foo bar' --verbose";
+    char line1[] = "get \"a\\\"b\" --key c\\ d";
+#elif defined(HAVE_GETOPT)
+    char line0[] = "get -k 'foo bar' -v";
+    char line1[] = "get -k c\\ d \"a\\\"b\"";
+#else
+    char line0[] = "";
+    char line1[] = "";
+#endif
+    char *tokens[8];
+    char *dummy_argv[] = {"repl", NULL};
+    optlib_parser *parser = optlib_parser_new(1, dummy_argv);
+    optlib_parser_add_option(parser, "key", 'k', true, "Key to look up.");
+    optlib_parser_add_option(parser, "verbose", 'v', false, "Be verbose.");
+
+    test_assert(optlib_parser_reset_line(parser, line0, tokens, 8) == 4);
+    test_assert(parser->argc == 4);
+    test_assert(!strcmp(tokens[0], "get"));
+    test_assert(!strcmp(tokens[2], "foo bar"));
+    test_assert(tokens[4] == NULL);
+    char *key = NULL;
+    bool verbose = false;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        test_assert(opt);
+        if (opt->short_opt == 'k') key = opt->argval;
+        if (opt->short_opt == 'v') verbose = true;
+    }
+    test_assert(key && !strcmp(key, "foo bar"));
+    test_assert(verbose);
+
+    test_assert(optlib_parser_reset_line(parser, line1, tokens, 8) == 4);
+    key = NULL;
+    verbose = false;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        test_assert(opt);
+        if (opt->short_opt == 'k') key = opt->argval;
+        if (opt->short_opt == 'v') verbose = true;
+    }
+    test_assert(key && !strcmp(key, "c d"));
+    test_assert(!verbose);
+    test_assert(!strcmp(parser->argv[parser->optind], "a\"b"));
+
+    char unterminated[] = "get 'foo";
+    test_assert(optlib_tokenize(unterminated, tokens, 8) == -1);
+    char too_many[] = "a b c d e f g h";
+    test_assert(optlib_tokenize(too_many, tokens, 8) == -1);
+    char empty[] = "   ";
+    test_assert(optlib_tokenize(empty, tokens, 8) == 0);
+    test_assert(optlib_parser_reset_line(parser, empty, tokens, 8) == 0);
+    char bad[] = "get -k \\";
+    test_assert(optlib_parser_reset_line(parser, bad, tokens, 8) == -1);
+    test_assert(parser->argc == 4);
+
+    optlib_parser_free(parser);
+    puts("test_case_2 finished normally.");
+    return true;
+}
+
+static void set_env(char const *name, char const *value) {
+#ifdef _WIN32
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+}
+
+static void unset_env(char const *name) {
+#ifdef _WIN32
+    _putenv_s(name, "");
+#else
+    unsetenv(name);
+#endif
+}
+
+/* Runs the parser to the end and returns the number of errors. */
+static int drain_errors(optlib_parser *parser) {
+    int errors = 0;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        if (!opt) ++errors;
+    }
+    return errors;
+}
+
+static int count_errors(optlib_parser *parser, int argc, char **argv) {
+    optlib_parser_reset(parser, argc, argv);
+    return drain_errors(parser);
+}
+
+bool test_case_3() {
+#ifdef _WIN32
+    char *argv[] = {"tool", "-Name", "from-argv", NULL};
+#elif defined(HAVE_GETOPT_LONG)
+    char *argv[] = {"tool", "--name", "from-argv", NULL};
+#elif defined(HAVE_GETOPT)
+    char *argv[] = {"tool", "-n", "from-argv", NULL};
+#else
+    char *argv[] = {NULL};
+#endif
+    set_env("OPTLIBTEST_NAME", "from-env");
+    set_env("OPTLIBTEST_LOG_LEVEL", "debug");
+    set_env("OPTLIBTEST_COLOR", "yes");
+    set_env("OPTLIBTEST_QUIET", "off");
+
+    optlib_parser *parser = optlib_parser_new(3, argv);
+    optlib_parser_add_option(parser, "name", 'n', true, "Name.");
+    optlib_parser_add_option(parser, "log-level", 'l', true, "Log level.");
+    optlib_parser_add_option(parser, "color", 'c', false, "Colorize.");
+    optlib_parser_add_option(parser, "quiet", 'q', false, "Be quiet.");
+    test_assert(optlib_parser_set_env_prefix(parser, "OPTLIBTEST"));
+
+    char *name = NULL;
+    char *log_level = NULL;
+    int name_count = 0;
+    bool color = false;
+    bool quiet = false;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        test_assert(opt);
+        switch (opt->short_opt) {
+        case 'n':
+            name = opt->argval;
+            ++name_count;
+            break;
+        case 'l':
+            log_level = opt->argval;
+            break;
+        case 'c':
+            color = true;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        }
+    }
+    test_assert(name_count == 1);
+    test_assert(!strcmp(name, "from-argv"));
+    test_assert(log_level && !strcmp(log_level, "debug"));
+    test_assert(log_level == getenv("OPTLIBTEST_LOG_LEVEL"));
+    test_assert(color);
+    test_assert(!quiet);
+
+    set_env("OPTLIBTEST_COLOR", "maybe");
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+    test_assert(count_errors(parser, 3, argv) == 1);
+
+#ifndef _WIN32
+    /* _putenv_s() removes variables set to "" */
+    set_env("OPTLIBTEST_COLOR", "yes");
+    set_env("OPTLIBTEST_LOG_LEVEL", "");
+    test_assert(count_errors(parser, 3, argv) == 1);
+#endif
+
+    unset_env("OPTLIBTEST_NAME");
+    unset_env("OPTLIBTEST_LOG_LEVEL");
+    unset_env("OPTLIBTEST_COLOR");
+    unset_env("OPTLIBTEST_QUIET");
+    optlib_parser_free(parser);
+    puts("test_case_3 finished normally.");
+    return true;
+}
+
+static void write_file(char const *path, char const *content) {
+    FILE *f = fopen(path, "wb");
+    fputs(content, f);
+    fclose(f);
+}
+
+bool test_case_4() {
+#ifdef _WIN32
+    char *argv[] = {"server", "-Port", "8080", NULL};
+#elif defined(HAVE_GETOPT_LONG)
+    char *argv[] = {"server", "--port", "8080", NULL};
+#elif defined(HAVE_GETOPT)
+    char *argv[] = {"server", "-p", "8080", NULL};
+#else
+    char *argv[] = {NULL};
+#endif
+    char const *path = "optlib_test_case_4.conf";
+    write_file(path, "# server settings\n"
+                     "port = 80\n"
+                     "\n"
+                     "  bind-address =  0.0.0.0  \r\n"
+                     "log_level = info\n"
+                     "daemon = true\n"
+                     "unknown-key = ignored\n"
+                     "log-level = warn");
+    set_env("OPTLIBTEST4_LOG_LEVEL", "debug");
+
+    optlib_parser *parser = optlib_parser_new(3, argv);
+    optlib_parser_add_option(parser, "port", 'p', true, "Port.");
+    optlib_parser_add_option(parser, "bind-address", 'b', true, "Address.");
+    optlib_parser_add_option(parser, "log-level", 'l', true, "Log level.");
+    optlib_parser_add_option(parser, "daemon", 'd', false, "Daemonize.");
+    optlib_parser_add_option(parser, "user", 'u', true, "User.");
+    test_assert(optlib_parser_load_config(parser, path));
+
+    char *port = NULL;
+    char *bind_address = NULL;
+    char *log_level = NULL;
+    char *user = NULL;
+    bool daemon = false;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        test_assert(opt);
+        switch (opt->short_opt) {
+        case 'p':
+            port = opt->argval;
+            break;
+        case 'b':
+            bind_address = opt->argval;
+            break;
+        case 'l':
+            log_level = opt->argval;
+            break;
+        case 'd':
+            daemon = true;
+            break;
+        case 'u':
+            user = opt->argval;
+            break;
+        }
+    }
+    test_assert(!strcmp(port, "8080"));
+    test_assert(!strcmp(bind_address, "0.0.0.0"));
+    test_assert(!strcmp(log_level, "warn"));
+    test_assert(daemon);
+    test_assert(!user);
+
+    optlib_parser_set_env_prefix(parser, "OPTLIBTEST4");
+    optlib_parser_reset(parser, 3, argv);
+    log_level = NULL;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        if (opt->short_opt == 'l') log_level = opt->argval;
+    }
+    test_assert(!strcmp(log_level, "debug"));
+
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+    write_file(path, "port = 80\ndaemon\n");
+    test_assert(!optlib_parser_load_config(parser, path));
+    write_file(path, "port = 80\ndaemon = sometimes\n");
+    test_assert(optlib_parser_load_config(parser, path));
+    optlib_parser_set_env_prefix(parser, NULL);
+    test_assert(count_errors(parser, 3, argv) == 1);
+    test_assert(!optlib_parser_load_config(parser, "no-such-file.conf"));
+
+    unset_env("OPTLIBTEST4_LOG_LEVEL");
+    optlib_parser_free(parser);
+    remove(path);
+    puts("test_case_4 finished normally.");
+    return true;
+}
+
+#ifdef _WIN32
+#    define ARG(gnu, posix, w32) w32
+#elif defined(HAVE_GETOPT_LONG)
+#    define ARG(gnu, posix, w32) gnu
+#else
+#    define ARG(gnu, posix, w32) posix
+#endif
+
+bool test_case_5() {
+    char *argv0[] = {"tls", ARG("--mode-a", "-a", "-ModeA"), NULL};
+    optlib_parser *parser = optlib_parser_new(2, argv0);
+    optlib_parser_add_option(parser, "mode-a", 'a', false, "Mode A.");
+    optlib_parser_add_option(parser, "mode-b", 'b', false, "Mode B.");
+    optlib_parser_add_option(parser, "mode-c", 'c', false, "Mode C.");
+    optlib_parser_add_option(parser, "key", 'k', true, "Key file.");
+    optlib_parser_add_option(parser, "cert", 'C', true, "Certificate.");
+    optlib_parser_add_option(parser, "verbose", 'v', false, "Be verbose.");
+    optlib_parser_add_option(parser, "quiet", 'q', false, "Be quiet.");
+    optlib_parser_add_option(parser, "host", 'h', true, "Host.");
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+
+    char const *modes[] = {"mode-a", "mode-b", "mode-c", NULL};
+    char const *key_cert[] = {"key", "cert", NULL};
+    char const *verbose_quiet[] = {"verbose", "q", NULL};
+    char const *host[] = {"host", NULL};
+    char const *unknown[] = {"key", "no-such-option", NULL};
+    test_assert(optlib_parser_add_constraint(parser, OPTLIB_MUTUALLY_EXCLUSIVE,
+                                             modes));
+    test_assert(
+        optlib_parser_add_constraint(parser, OPTLIB_AT_LEAST_ONE, modes));
+    test_assert(
+        optlib_parser_add_constraint(parser, OPTLIB_REQUIRES, key_cert));
+    test_assert(optlib_parser_add_constraint(parser, OPTLIB_CONFLICTS,
+                                             verbose_quiet));
+    test_assert(optlib_parser_add_constraint(parser, OPTLIB_REQUIRED, host));
+    test_assert(
+        !optlib_parser_add_constraint(parser, OPTLIB_REQUIRES, unknown));
+    test_assert(!optlib_parser_add_constraint(parser, OPTLIB_REQUIRES, host));
+
+    char *argv1[] = {"tls", ARG("--mode-a", "-a", "-ModeA"),
+                     ARG("--host", "-h", "-Host"), "example.com", NULL};
+    test_assert(count_errors(parser, 4, argv1) == 0);
+
+    test_assert(count_errors(parser, 2, argv0) == 1);
+
+    char *argv2[] = {"tls",
+                     ARG("--mode-a", "-a", "-ModeA"),
+                     ARG("--mode-c", "-c", "-ModeC"),
+                     ARG("--host", "-h", "-Host"),
+                     "example.com",
+                     NULL};
+    test_assert(count_errors(parser, 5, argv2) == 1);
+
+    char *argv3[] = {"tls",
+                     ARG("--key", "-k", "-Key"),
+                     "key.pem",
+                     ARG("--verbose", "-v", "-Verbose"),
+                     ARG("--quiet", "-q", "-Quiet"),
+                     NULL};
+    test_assert(count_errors(parser, 5, argv3) == 4);
+
+    char *argv4[] = {"tls",
+                     ARG("--mode-b", "-b", "-ModeB"),
+                     ARG("--key", "-k", "-Key"),
+                     "key.pem",
+                     ARG("--cert", "-C", "-Cert"),
+                     "cert.pem",
+                     ARG("--host", "-h", "-Host"),
+                     "example.com",
+                     NULL};
+    test_assert(count_errors(parser, 8, argv4) == 0);
+
+    optlib_parser_free(parser);
+    puts("test_case_5 finished normally.");
+    return true;
+}
+
+typedef struct counting_allocator {
+    size_t live;
+    size_t bytes;
+    size_t calls;
+    /* the call which fails, or 0 */
+    size_t fail_at;
+} counting_allocator;
+
+static void *counting_alloc(void *ctx, size_t size) {
+    counting_allocator *ca = ctx;
+    if (++ca->calls == ca->fail_at) return NULL;
+    ++ca->live;
+    ca->bytes += size;
+    return malloc(size);
+}
+
+static void *counting_resize(void *ctx, void *ptr, size_t old_size,
+                             size_t new_size) {
+    counting_allocator *ca = ctx;
+    if (++ca->calls == ca->fail_at) return NULL;
+    void *result = realloc(ptr, new_size);
+    ca->bytes += new_size;
+    ca->bytes -= old_size;
+    return result;
+}
+
+static void counting_release(void *ctx, void *ptr, size_t size) {
+    counting_allocator *ca = ctx;
+    --ca->live;
+    ca->bytes -= size;
+    free(ptr);
+}
+
+/* Runs every allocating path once; returns false if any of them failed. */
+static bool run_allocating_paths(optlib_allocator const *a, char *argv[],
+                                 char const *conf_path,
+                                 char const *snapshot_path) {
+    optlib_parser *parser = optlib_parser_new_with_allocator(4, argv, a);
+    if (!parser) return false;
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+    bool ok = true;
+    char const *required[] = {"verbose", NULL};
+    char const *requires[] = {"name", "level", NULL};
+    char const *names[] = {"name", "level", "verbose", "count", "a1", "a2",
+                           "a3",   "a4",    "a5",      "a6",    NULL};
+    for (int i = 0; names[i]; ++i) {
+        ok = ok && optlib_parser_add_option(parser, names[i], (char)('a' + i),
+                                            i < 2, "description");
+    }
+    ok = ok && optlib_parser_add_option(parser, NULL, 'z', false, NULL);
+    ok = ok && optlib_parser_set_env_prefix(parser, "OPTLIBTEST6");
+    ok = ok && optlib_parser_load_config(parser, conf_path);
+    ok = ok &&
+         optlib_parser_add_constraint(parser, OPTLIB_REQUIRED, required);
+    ok = ok &&
+         optlib_parser_add_constraint(parser, OPTLIB_REQUIRES, requires);
+
+    int seen = 0;
+    while (ok) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        if (!opt) {
+            ok = false;
+            break;
+        }
+        ++seen;
+    }
+    ok = ok && seen == 3;
+
+    /* overlays do not apply to batches, so "level" is missing */
+    optlib_argv vectors[] = {{4, argv}, {4, argv}, {4, argv}};
+    optlib_batch_result results[3];
+    ok = ok && optlib_parse_batch(parser, vectors, 3, NULL, results, 2);
+    ok = ok && results[2].error == OPTLIB_ERROR_CONSTRAINT &&
+         results[2].constraint == 1;
+    ok = ok && optlib_parser_save_snapshot(parser, snapshot_path);
+
+    test_assert(parser->alloc_stats.live_allocations ==
+                ((counting_allocator *)a->ctx)->live);
+    test_assert(parser->alloc_stats.peak_bytes >=
+                parser->alloc_stats.current_bytes);
+    optlib_parser_free(parser);
+    if (!ok) return false;
+
+    parser = optlib_parser_new_with_allocator(4, argv, a);
+    if (!parser) return false;
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+    ok = optlib_parser_load_snapshot(parser, snapshot_path);
+    ok = ok && optlib_parser_add_option(parser, "extra", 'y', false, NULL);
+    seen = 0;
+    while (ok) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        if (!opt) {
+            ok = false;
+            break;
+        }
+        ++seen;
+    }
+    ok = ok && seen == 2;
+    optlib_parser_free(parser);
+    return ok;
+}
+
+bool test_case_6() {
+    char *argv[] = {"alloc", ARG("--name", "-a", "-Name"), "x",
+                    ARG("--verbose", "-c", "-Verbose"), NULL};
+    char const *path = "optlib_test_case_6.conf";
+    char const *snapshot_path = "optlib_test_case_6.snapshot";
+    write_file(path, "level = 3\ncount = no\nlevel = 4");
+
+    counting_allocator ca;
+    optlib_allocator a = {&counting_alloc, &counting_resize,
+                          &counting_release, &ca};
+
+    memset(&ca, 0, sizeof(ca));
+    test_assert(run_allocating_paths(&a, argv, path, snapshot_path));
+    test_assert(ca.live == 0);
+    test_assert(ca.bytes == 0);
+    size_t total_calls = ca.calls;
+
+    /* fail each allocation in turn; everything must still be released */
+    bool all_released = true;
+    bool all_failed = true;
+    for (size_t i = 1; i <= total_calls; ++i) {
+        memset(&ca, 0, sizeof(ca));
+        ca.fail_at = i;
+        all_failed &= !run_allocating_paths(&a, argv, path, snapshot_path);
+        all_released &= ca.live == 0 && ca.bytes == 0;
+    }
+    test_assert(all_failed);
+    test_assert(all_released);
+
+    optlib_parser *parser = optlib_parser_new_with_allocator(1, argv, NULL);
+    test_assert(parser);
+    test_assert(optlib_parser_add_option(parser, "name", 'n', true, NULL));
+    test_assert(parser->alloc_stats.live_allocations > 0);
+    optlib_parser_free(parser);
+
+    remove(path);
+    remove(snapshot_path);
+    puts("test_case_6 finished normally.");
+    return true;
+}
+
+bool test_case_7() {
+    static char const cmdline0[] =
+        "agent\0" ARG("--name=foo\0", "-nfoo\0", "-Name\0foo\0")
+            ARG("--verb\0", "-v\0", "-Verbose\0")
+                ARG("-ql\0" "3\0", "-ql\0" "3\0", "-Quiet\0-Level\0" "3\0")
+                    "file.txt\0";
+    static char const cmdline1[] = "agent\0" ARG(
+        "--bogus\0--level\0", "-x\0-l\0", "-Bogus\0-Level\0");
+    static char const cmdline2[] = "agent\0" ARG("-v", "-v", "-Verbose");
+    char copy[sizeof(cmdline0)];
+    memcpy(copy, cmdline0, sizeof(cmdline0));
+
+    char *argv[] = {"agent", NULL};
+    optlib_parser *parser = optlib_parser_new(1, argv);
+    optlib_parser_add_option(parser, "name", 'n', true, "Name.");
+    optlib_parser_add_option(parser, "verbose", 'v', false, "Be verbose.");
+    optlib_parser_add_option(parser, "quiet", 'q', false, "Be quiet.");
+    optlib_parser_add_option(parser, "level", 'l', true, "Level.");
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+
+    char const *name = NULL;
+    char const *level = NULL;
+    bool verbose = false;
+    bool quiet = false;
+    test_assert(
+        optlib_parser_reset_buffer(parser, cmdline0, sizeof(cmdline0) - 1));
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        test_assert(opt);
+        switch (opt->short_opt) {
+        case 'n':
+            name = opt->argval;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 'l':
+            level = opt->argval;
+            break;
+        }
+    }
+    test_assert(name && !strcmp(name, "foo"));
+    test_assert(name > cmdline0 && name < cmdline0 + sizeof(cmdline0));
+    test_assert(verbose);
+    test_assert(quiet);
+    test_assert(level && !strcmp(level, "3"));
+    test_assert(!memcmp(copy, cmdline0, sizeof(cmdline0)));
+
+    test_assert(
+        optlib_parser_reset_buffer(parser, cmdline1, sizeof(cmdline1) - 1));
+    test_assert(drain_errors(parser) == 2);
+
+    verbose = false;
+    test_assert(
+        optlib_parser_reset_buffer(parser, cmdline2, sizeof(cmdline2) - 1));
+    for (;;) {
+        optlib_next(parser);
+        if (parser->finished) break;
+        verbose = true;
+    }
+    test_assert(!verbose);
+    test_assert(!optlib_parser_reset_buffer(parser, "agent", 5));
+
+    optlib_parser_free(parser);
+    puts("test_case_7 finished normally.");
+    return true;
+}
+
+static bool same_help(optlib_parser *a, optlib_parser *b) {
+    char help_a[1024] = {0};
+    char help_b[1024] = {0};
+    FILE *f = tmpfile();
+    optlib_print_help(a, f);
+    rewind(f);
+    fread(help_a, 1, sizeof(help_a) - 1, f);
+    fclose(f);
+    f = tmpfile();
+    optlib_print_help(b, f);
+    rewind(f);
+    fread(help_b, 1, sizeof(help_b) - 1, f);
+    fclose(f);
+    return help_a[0] && !strcmp(help_a, help_b);
+}
+
+bool test_case_8() {
+    char *argv[] = {"tool",
+                    ARG("--output", "-o", "-Output"),
+                    "out.txt",
+                    ARG("--dry-run", "-n", "-DryRun"),
+                    ARG("--jobs", "-j", "-Jobs"),
+                    "4",
+                    NULL};
+    char const *path = "optlib_test_case_8.snapshot";
+
+    optlib_parser *source = optlib_parser_new(6, argv);
+    optlib_parser_add_option(source, "output", 'o', true, "Output file.");
+    optlib_parser_add_option(source, "dry-run", 'n', false, "Do nothing.");
+    optlib_parser_add_option(source, "jobs", 'j', true, "Parallel jobs.");
+    optlib_parser_add_option(source, "color", 0, false, "Colorize.");
+    optlib_parser_add_option(source, NULL, 'q', false, "Be quiet.");
+    test_assert(optlib_parser_save_snapshot(source, path));
+
+    optlib_parser *parser = optlib_parser_new(6, argv);
+    test_assert(optlib_parser_load_snapshot(parser, path));
+    test_assert(!optlib_parser_load_snapshot(parser, path));
+    test_assert(same_help(source, parser));
+
+    char *output = NULL;
+    char *jobs = NULL;
+    bool dry_run = false;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        test_assert(opt);
+        switch (opt->short_opt) {
+        case 'o':
+            output = opt->argval;
+            break;
+        case 'n':
+            dry_run = true;
+            break;
+        case 'j':
+            jobs = opt->argval;
+            break;
+        }
+    }
+    test_assert(output && !strcmp(output, "out.txt"));
+    test_assert(dry_run);
+    test_assert(jobs && !strcmp(jobs, "4"));
+    test_assert(parser->alloc_stats.allocations <
+                source->alloc_stats.allocations);
+
+    /* options added after loading are owned by the parser */
+    test_assert(optlib_parser_add_option(parser, "extra", 'x', false, "X."));
+    optlib_parser_reset(parser, 6, argv);
+    int count = 0;
+    while (optlib_next(parser) || !parser->finished) {
+        ++count;
+    }
+    test_assert(count == 3);
+    optlib_parser_free(parser);
+
+    FILE *f = fopen(path, "r+b");
+    fseek(f, -3, SEEK_END);
+    fputc('#', f);
+    fclose(f);
+    parser = optlib_parser_new(6, argv);
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+    test_assert(!optlib_parser_load_snapshot(parser, path));
+    test_assert(!optlib_parser_load_snapshot(parser, "no-such.snapshot"));
+    optlib_parser_free(parser);
+
+    optlib_parser_free(source);
+    remove(path);
+    puts("test_case_8 finished normally.");
+    return true;
+}
+
+/* Checks a batch result against parsing a copy of argv with optlib_next().
+   shorts lists the short option of every option in order of declaration. */
+static bool same_as_serial(optlib_parser *parser, char *const *argv,
+                           char const *shorts, optlib_batch_result const *r,
+                           char const **values) {
+    char *copy[8];
+    int argc = 0;
+    for (; argv[argc]; ++argc) {
+        copy[argc] = argv[argc];
+    }
+    copy[argc] = NULL;
+    optlib_parser_reset(parser, argc, copy);
+
+    bool error = false;
+    bool same = true;
+    unsigned given = 0;
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        if (!opt) {
+            error = true;
+            continue;
+        }
+        size_t i = (size_t)(strchr(shorts, opt->short_opt) - shorts);
+        given |= 1u << i;
+        same &= values[i] && (!opt->has_arg || !strcmp(values[i], opt->argval));
+    }
+    if (error) return r->error != OPTLIB_ERROR_NONE;
+
+    for (size_t i = 0; shorts[i]; ++i) {
+        same &= !values[i] == !(given & 1u << i);
+    }
+    return same && r->error == OPTLIB_ERROR_NONE;
+}
+
+#define BATCH_SIZE 1000
+
+bool test_case_9() {
+    char *valid[] = {"job", ARG("--queue", "-Q", "-Queue"), "fast",
+                     ARG("--retry", "-r", "-Retry"), "input.txt", NULL};
+    char *unknown[] = {"job", ARG("--bogus", "-x", "-Bogus"), NULL};
+    char *missing[] = {"job", ARG("--retry", "-r", "-Retry"),
+                       ARG("--queue", "-Q", "-Queue"), NULL};
+    char *conflict[] = {"job", ARG("--queue", "-Q", "-Queue"), "slow",
+                        ARG("--dry-run", "-n", "-DryRun"), NULL};
+    optlib_argv templates[] = {{5, valid}, {2, unknown}, {3, missing},
+                               {4, conflict}};
+
+    optlib_parser *parser = optlib_parser_new(1, valid);
+    optlib_parser_add_option(parser, "queue", 'Q', true, "Queue name.");
+    optlib_parser_add_option(parser, "retry", 'r', false, "Retry on error.");
+    optlib_parser_add_option(parser, "dry-run", 'n', false, "Do nothing.");
+    char const *queue_conflicts[] = {"queue", "dry-run", NULL};
+    optlib_parser_add_constraint(parser, OPTLIB_CONFLICTS, queue_conflicts);
+
+    static optlib_argv vectors[BATCH_SIZE];
+    static char const *values[BATCH_SIZE * 3];
+    static optlib_batch_result results[BATCH_SIZE];
+    static optlib_batch_result serial_results[BATCH_SIZE];
+    for (size_t i = 0; i < BATCH_SIZE; ++i) {
+        vectors[i] = templates[i * 7 % 4];
+    }
+
+    test_assert(optlib_parse_batch(parser, vectors, BATCH_SIZE, NULL,
+                                   serial_results, 1));
+    test_assert(
+        optlib_parse_batch(parser, vectors, BATCH_SIZE, values, results, 4));
+
+    bool consistent = true;
+    size_t errors[OPTLIB_ERROR_CONSTRAINT + 1] = {0};
+    for (size_t i = 0; i < BATCH_SIZE; ++i) {
+        consistent &= results[i].error == serial_results[i].error &&
+                      results[i].error_index == serial_results[i].error_index;
+        ++errors[results[i].error];
+    }
+    test_assert(consistent);
+    test_assert(errors[OPTLIB_ERROR_NONE] == BATCH_SIZE / 4);
+    test_assert(errors[OPTLIB_ERROR_CONSTRAINT] == BATCH_SIZE / 4);
+
+    size_t v = 0;
+    while (vectors[v].argv != valid) {
+        ++v;
+    }
+    test_assert(!strcmp(values[v * 3], "fast"));
+    test_assert(values[v * 3 + 1] == valid[3]);
+    test_assert(values[v * 3 + 2] == NULL);
+
+    while (vectors[v].argv != unknown) {
+        ++v;
+    }
+#ifdef _WIN32
+    test_assert(results[v].error == OPTLIB_ERROR_UNRECOGNIZED_OPTION);
+#elif defined(HAVE_GETOPT_LONG)
+    test_assert(results[v].error == OPTLIB_ERROR_UNRECOGNIZED_OPTION);
+#else
+    test_assert(results[v].error == OPTLIB_ERROR_INVALID_OPTION);
+#endif
+    test_assert(results[v].error_index == 1);
+
+    while (vectors[v].argv != missing) {
+        ++v;
+    }
+    test_assert(results[v].error == OPTLIB_ERROR_MISSING_ARGUMENT);
+    test_assert(results[v].error_index == 2);
+
+    while (vectors[v].argv != conflict) {
+        ++v;
+    }
+    test_assert(results[v].constraint == 0);
+
+    /* the tool parses accepted vectors with optlib_next() */
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+    bool serial = true;
+    for (size_t t = 0; t < 4; ++t) {
+        v = 0;
+        while (vectors[v].argv != templates[t].argv) {
+            ++v;
+        }
+        serial &= same_as_serial(parser, templates[t].argv, "Qrn",
+                                 &results[v], values + v * 3);
+    }
+    test_assert(serial);
+
+    optlib_parser_free(parser);
+    puts("test_case_9 finished normally.");
+    return true;
+}
+
+/* Records what the parser yields, as " c" or " c=value" per option and
+   " !" per error. */
+static void trace_options(optlib_parser *parser, char *out, size_t size) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (;;) {
+        optlib_option *opt = optlib_next(parser);
+        if (parser->finished) break;
+        if (!opt) {
+            len += (size_t)snprintf(out + len, size - len, " !");
+        } else if (opt->has_arg) {
+            len += (size_t)snprintf(out + len, size - len, " %c=%s",
+                                    opt->short_opt, opt->argval);
+        } else {
+            len += (size_t)snprintf(out + len, size - len, " %c",
+                                    opt->short_opt);
+        }
+    }
+}
+
+/* Parses argv with getopt and as a NUL-separated buffer, and checks that
+   both give the same options and errors. */
+static bool same_as_buffer(optlib_parser *parser, char **argv) {
+    char buf[256];
+    size_t len = 0;
+    int argc = 0;
+    for (; argv[argc]; ++argc) {
+        size_t n = strlen(argv[argc]) + 1;
+        memcpy(buf + len, argv[argc], n);
+        len += n;
+    }
+
+    /* getopt_long permutes argv, so it goes after the copy */
+    char from_argv[256];
+    char from_buffer[256];
+    optlib_parser_reset(parser, argc, argv);
+    trace_options(parser, from_argv, sizeof(from_argv));
+    optlib_parser_reset_buffer(parser, buf, len);
+    trace_options(parser, from_buffer, sizeof(from_buffer));
+    return !strcmp(from_argv, from_buffer);
+}
+
+bool test_case_10() {
+#ifdef _WIN32
+    char *vectors[][6] = {
+        {"x", "-Verbose", "-Level", "3", NULL},
+        {"x", "op", "-Version", "-List", NULL},
+        {"x", "-Bogus", "-Level", NULL},
+    };
+#elif defined(HAVE_GETOPT_LONG)
+    char *vectors[][6] = {
+        {"x", "--ver", NULL},
+        {"x", "--l", NULL},
+        {"x", "--le", "v", "--verb", NULL},
+        {"x", "op", "-l", "v", "--version", NULL},
+        {"x", "-vl3", "--", "-v", NULL},
+        {"x", "--bogus", "-q", "--level", NULL},
+        {"x", "--verbose=1", "--level=2", "-L", NULL},
+    };
+#else
+    /* whether getopt permutes operands differs between C libraries */
+    char *vectors[][6] = {
+        {"x", "-v", "-l", "3", NULL},
+        {"x", "-vl3", "-v", "op", NULL},
+        {"x", "-q", "-l", NULL},
+        {"x", "-Ll", "--", "-v", NULL},
+    };
+#endif
+    char *argv[] = {"x", NULL};
+    optlib_parser *parser = optlib_parser_new(1, argv);
+    optlib_parser_add_option(parser, "verbose", 'v', false, "Be verbose.");
+    optlib_parser_add_option(parser, "version", 'V', false, "Show version.");
+    optlib_parser_add_option(parser, "list", 'L', false, "List levels.");
+    optlib_parser_add_option(parser, "level", 'l', true, "Level.");
+#if defined(HAVE_GETOPT_LONG) || defined(HAVE_GETOPT)
+    parser->opterr = 0;
+#endif
+
+    size_t count = sizeof(vectors) / sizeof(vectors[0]);
+    optlib_argv batch[sizeof(vectors) / sizeof(vectors[0])];
+    char const *values[sizeof(vectors) / sizeof(vectors[0]) * 4];
+    optlib_batch_result results[sizeof(vectors) / sizeof(vectors[0])];
+    for (size_t i = 0; i < count; ++i) {
+        int argc = 0;
+        while (vectors[i][argc]) {
+            ++argc;
+        }
+        batch[i].argc = argc;
+        batch[i].argv = vectors[i];
+    }
+    test_assert(optlib_parse_batch(parser, batch, count, values, results, 2));
+    bool serial = true;
+    for (size_t i = 0; i < count; ++i) {
+        serial &= same_as_serial(parser, vectors[i], "vVLl", &results[i],
+                                 values + i * 4);
+    }
+    test_assert(serial);
+
+    bool same = true;
+    for (size_t i = 0; i < count; ++i) {
+        same &= same_as_buffer(parser, vectors[i]);
+    }
+    test_assert(same);
+
+#if !defined(_WIN32) && defined(HAVE_GETOPT_LONG)
+    char *operand_first[] = {"x", "op", "-l", "v", NULL};
+    set_env("POSIXLY_CORRECT", "1");
+    optlib_argv operand_batch = {4, operand_first};
+    test_assert(
+        optlib_parse_batch(parser, &operand_batch, 1, values, results, 1));
+    test_assert(same_as_serial(parser, operand_first, "vVLl", results, values));
+    test_assert(same_as_buffer(parser, operand_first));
+    unset_env("POSIXLY_CORRECT");
+#endif
+
+    optlib_parser_free(parser);
+    puts("test_case_10 finished normally.");
+    return true;
+}
+
 int main(void) {
-    bool (*test_cases[])(void) = {&test_case_0, &test_case_1, NULL};
+    bool (*test_cases[])(void) = {&test_case_0, &test_case_1, &test_case_2,
+                                  &test_case_3, &test_case_4, &test_case_5,
+                                  &test_case_6, &test_case_7, &test_case_8,
+                                  &test_case_9, &test_case_10, NULL};
     for (int i = 0;; ++i) {
         if (!test_cases[i]) {
             break;